@@ -12,11 +12,18 @@ enum exec_status {
     EXECUTING,
     IN_SYSCALL,
     HALTED,
+    STOPPED,
+    SLEEPING,
+    WAITING,
     ERROR_UNVERIFIED,
     ERROR_SYSC_MISMATCHED_ARGS,
     ERROR_SYSC_MISMATCHED_RETS,
     ERROR_SYSC_INVALID_ARG,
     ERROR_SYSC_INVALID_STATE,
+    ERROR_DIVIDE_BY_ZERO,
+    ERROR_LOCAL_OUT_OF_RANGE,
+    ERROR_CONSTANT_OUT_OF_RANGE,
+    __EXEC_STATUS_COUNT
 };
 
 enum verify_status {
@@ -33,6 +40,24 @@ enum verify_status {
     INVALID_STATE,
     INVALID_SYSCALL_NUMBER,
     INVALID_SYSCALL_UNMAPPED,
+    INVALID_BITFIELD,
+    INVALID_REGISTER,
+    INVALID_LOOP,
+    INVALID_CONSTANT,
+};
+
+// result of allocation and state machine lifecycle requests:
+enum trex_result {
+    RESULT_OK,
+    RESULT_OUT_OF_MEMORY,
+    RESULT_TOO_MANY_MACHINES,
+    RESULT_NAME_EXISTS,
+    RESULT_NAME_NOT_FOUND,
+    RESULT_INVALID_STATE,
+    RESULT_RUNNING,
+    RESULT_UNVERIFIED,
+    RESULT_INVALID_SNAPSHOT,
+    RESULT_OVER_BUDGET,
 };
 
 // state handler:
@@ -48,12 +73,37 @@ struct trex_sh {
     uint32_t max_targets;
     uint32_t depth;
 
+    // most cycles any path through the handler can take, including syscall costs:
+    uint32_t max_cost;
+    // union of enum trex_syscall_effect over every syscall the handler contains:
+    uint8_t  effects;
+
     // points to where program code starts:
     uint8_t *pc_start;
     // points to one past last program byte:
     uint8_t *pc_end;
 };
 
+#ifdef TREX_STATS
+// execution counters of a state machine, compiled in with TREX_STATS:
+struct trex_sm_stats {
+    // instructions executed, including syscall instructions and their declared costs:
+    uint32_t instructions;
+    // syscalls executed:
+    uint32_t syscalls;
+    // handlers that returned or halted:
+    uint32_t completions;
+    // scheduler slots given to the state machine:
+    uint32_t slots;
+    // times a handler used up its cycles before completing:
+    uint32_t preemptions;
+    // most cycles used by a single handler from start to completion:
+    uint32_t max_handler_cycles;
+    // cycles used so far by the handler in progress:
+    uint32_t handler_cycles;
+};
+#endif
+
 // state machine:
 struct trex_sm {
     //// mutable properties of state machine:
@@ -63,11 +113,40 @@ struct trex_sm {
     uint16_t         st;
     // next state number:
     uint16_t         nxst;
+    // stop was requested in the middle of a handler; applied when the handler returns:
+    uint8_t          stopping;
+    // sleep was requested by the handler; applied when the handler returns:
+    uint8_t          sleeping;
+    // host time at which a SLEEPING machine becomes READY again:
+    uint32_t         wake_at;
+    // wait on an empty channel was requested by the handler; applied when the handler returns:
+    uint8_t          waiting;
+    // channel that the machine waits on:
+    uint8_t          channel;
+    // clock by which the machine should get its next slot, for trex_schedule_edf():
+    uint32_t         deadline;
 
     //// readonly properties of state machine established on create:
+    // unique name of the state machine:
+    uint32_t       name;
+
     // number of iterations of state handlers to run
     uint8_t        iterations;
 
+    // target cycles from the end of one slot to the start of the next; 0 for no target:
+    uint32_t       latency;
+
+    // most cycles per slot; a handler that would not fit in what is left of the slot waits for
+    // the next one. 0 for no quota:
+    uint32_t       quota;
+    // index into ctx->sessions of the session whose budget the machine shares, or TREX_NO_SESSION:
+    uint8_t        session;
+
+    // bit s set if state s continues into the next state on RET in the same scheduler slot instead
+    // of using up an iteration, if cycles remain; set with trex_sm_chain_state(). only the first
+    // TREX_CHAIN_STATES states can chain:
+    uint32_t       chain;
+
     // read/write area of memory for execution
     uint8_t        locals_count;
     uint32_t      *locals;
@@ -75,10 +154,139 @@ struct trex_sm {
     // list of state handlers
     uint16_t        handlers_count;
     struct trex_sh *handlers;
+
+    // arena block holding handlers, locals and bytecode if allocated by trex_sm_alloc:
+    struct trex_block *block;
+
+    // machine whose handlers and bytecode this instance shares, or 0 if they are its own:
+    struct trex_sm *tmpl;
+    // machines using this machine's handlers, itself included while not freed; the block is kept
+    // until the last of them is freed:
+    uint16_t        refs;
+
+#ifdef TREX_STATS
+    struct trex_sm_stats stats;
+#endif
+};
+
+// header of a relocatable arena block:
+struct trex_block {
+    // size of the block in bytes including this header:
+    uint32_t        size;
+    // state machine which owns the block:
+    struct trex_sm *owner;
+};
+
+#define TREX_NO_SESSION 0xFF
+#define TREX_CHAIN_STATES 32
+
+// cycle budget shared by the state machines of one client session:
+struct trex_session {
+    // most cycles the session's machines may use per trex_exec_at() call; 0 for no budget:
+    uint32_t budget;
+    // cycles used in the current trex_exec_at() call:
+    uint32_t used;
+};
+
+// bounded single-producer single-consumer queue of values between state machines:
+struct trex_channel {
+    // ring of mask + 1 values:
+    uint32_t *buf;
+    uint16_t  mask;
+    // free-running counts of values received and sent:
+    uint16_t  head;
+    uint16_t  tail;
+    // index + 1 of the WAITING machine to wake on the next send, or 0:
+    uint16_t  waiter;
+};
+
+// entry in the context's min-heap of sleeping state machines, ordered by wake_at:
+struct trex_sleeper {
+    uint32_t wake_at;
+    // index of the state machine in ctx->machines:
+    uint16_t machine;
+};
+
+// fixed memory region that trex allocates from.
+// relocatable blocks grow up from the bottom and are compacted when freed;
+// fixed allocations (stacks, machine tables) grow down from the top and are never freed.
+struct trex_arena {
+    uint8_t  *base;
+    uint32_t  size;
+
+    // bytes used by relocatable blocks at the bottom:
+    uint32_t  lo;
+    // bytes used by fixed allocations at the top:
+    uint32_t  hi;
+
+    // most bytes ever in use at once:
+    uint32_t  high_water;
+};
+
+#ifdef TREX_TRACE
+// kinds of trace events, compiled in with TREX_TRACE:
+enum trace_kind {
+    // scheduler switched to a state machine; data = machine name:
+    TRACE_MACHINE,
+    // state handler started; data = previous state << 16 | new state:
+    TRACE_STATE,
+    // syscall entered; arg = args popped, data = syscall number:
+    TRACE_SYSCALL_ENTER,
+    // syscall exited; arg = returns pushed, data = syscall number:
+    TRACE_SYSCALL_EXIT,
+    // state machine stopped with an error; data = exec_status:
+    TRACE_ERROR,
+};
+
+// binary trace event recorded into the context's trace ring:
+struct trex_trace_event {
+    // ctx->clock at the time of the event:
+    uint32_t time;
+    // index of the state machine in ctx->machines:
+    uint16_t machine;
+    // enum trace_kind:
+    uint8_t  kind;
+    uint8_t  arg;
+    uint32_t data;
+};
+#endif
+
+// size of the register file used by the register opcodes:
+#define TREX_REGISTERS 4
+
+// largest message the message syscalls can build:
+#define TREX_MESSAGE_SIZE 59
+
+// memory chip read and written directly by the built-in chip syscalls:
+struct trex_chip {
+    // host memory backing the chip, e.g. an emulator's WRAM array or an mmap of device memory:
+    uint8_t  *mem;
+    uint32_t  size;
 };
 
 struct trex_context;
 
+// side effects of a syscall, declared in its descriptor for the verifier.
+// a syscall that declares no effects at all is assumed to have every effect:
+enum trex_syscall_effect {
+    // result depends only on the args; may be folded, reordered or dropped:
+    SYSC_PURE          = 1 << 0,
+    // changes the chip or address used by later chip syscalls:
+    SYSC_CHIP_SELECT   = 1 << 1,
+    SYSC_READS_CHIP    = 1 << 2,
+    SYSC_WRITES_CHIP   = 1 << 3,
+    // builds or sends a message to the host, or passes values between machines:
+    SYSC_MESSAGE       = 1 << 4,
+    // reads ctx->now or ctx->clock:
+    SYSC_READS_TIME    = 1 << 5,
+    // may not complete right away, e.g. waiting on the host:
+    SYSC_MAY_BLOCK     = 1 << 6,
+    // host-defined or otherwise unknown side effects:
+    SYSC_HOST          = 1 << 7,
+};
+
+#define SYSC_EFFECTS_UNKNOWN 0xFE
+
 // syscall descriptor:
 struct trex_syscall {
     // name of the syscall
@@ -89,6 +297,11 @@ struct trex_syscall {
     // how many return values the syscall pushes back
     uint8_t  returns;
 
+    // cycles charged in addition to the one for the syscall instruction:
+    uint16_t cost;
+    // enum trex_syscall_effect flags; 0 means undeclared:
+    uint8_t  effects;
+
     // call must pop `args` values, do work, and push `returns` values:
     void (*call)(struct trex_context *ctx);
 };
@@ -99,6 +312,13 @@ struct trex_context {
     uint32_t    a;
     uint8_t     *pc;
     uint32_t    *sp;
+    // register file; like A, registers start undefined in each handler and the verifier rejects
+    // reading one before it is written:
+    uint32_t    r[TREX_REGISTERS];
+    // counted loop in progress; loops do not nest:
+    uint8_t     *loop_pc;
+    uint32_t    loop_index;
+    uint32_t    loop_count;
 
     unsigned curr_machine;
     struct trex_sm *sm;
@@ -118,13 +338,80 @@ struct trex_context {
     uint16_t                   syscalls_count;
     const struct trex_syscall *syscalls;
 
+    // interpreter that the scheduler runs handlers with, e.g. one specialized for the syscall
+    // table by trex.hpp; 0 for trex_sm_exec():
+    int (*exec)(struct trex_context *ctx, int cycles);
+
+    // read-only constant pool shared by all machines, e.g. lookup tables. the verifier checks
+    // constant indices and uses constant values, so the pool must not change once handlers using
+    // it are verified:
+    uint16_t        consts_count;
+    const uint32_t *consts;
+
+    // channels for the built-in channel syscalls:
+    uint8_t              channels_count;
+    struct trex_channel *channels;
+
+    // list of memory chips for the built-in chip syscalls:
+    uint8_t           chips_count;
+    struct trex_chip *chips;
+    // chip and address selected by chip-use and chip-address-set:
+    uint8_t           chip_curr;
+    uint32_t          chip_addr;
+
+    // message being built by the message-append syscalls:
+    uint8_t  message_size;
+    uint8_t  message[TREX_MESSAGE_SIZE];
+    // called by message-send with the current machine in ctx->sm; returns 0 if the host could not
+    // accept the message right now:
+    int (*message_send)(struct trex_context *ctx, const uint8_t *data, uint8_t size);
+
     // list of all state machines:
     unsigned        machines_count;
     struct trex_sm *machines;
 
+    // scheduling policy; picks the machine for the next slot from the runnable machines, or
+    // returns 0 if none are runnable. 0 selects the default round-robin policy:
+    struct trex_sm *(*schedule)(struct trex_context *ctx);
+    // round-robin position kept by policies that fall back to round-robin:
+    unsigned        schedule_next;
+    // cycles used by the current machine in its current slot:
+    uint32_t        slot_cycles;
+
+    // client sessions for cycle budgets:
+    uint8_t              sessions_count;
+    struct trex_session *sessions;
+
+    // min-heap of SLEEPING state machines by wake time; needs room for every machine:
+    struct trex_sleeper *sleepers;
+    uint16_t             sleepers_count;
+    uint16_t             sleepers_cap;
+
+    // open-addressing index of state machine names allocated by trex_machines_alloc();
+    // each entry is a machine index + 1, or 0 if empty:
+    uint16_t       *names;
+    uint8_t         names_bits;
+
     // how many instructions to advance per trex_exec() call:
     int cycles_per_exec;
 
+    // instructions executed since init; wraps around:
+    uint32_t clock;
+    // host time of the current trex_exec_at() call, e.g. emulated scanlines since power on.
+    // trex_exec() advances it by one tick per call:
+    uint32_t now;
+
+#ifdef TREX_TRACE
+    // ring of trace events; the number of events must be a power of two:
+    struct trex_trace_event *trace;
+    uint32_t                 trace_mask;
+    // count of events ever recorded; the next event goes to trace[trace_head & trace_mask]:
+    uint32_t                 trace_head;
+#endif
+
+    // optional arena for trex_sm_alloc():
+    struct trex_arena *arena;
+
     // opaque pointer for the host's use:
     void *hostdata;
 };
@@ -157,9 +444,276 @@ void trex_sm_verify(
     struct trex_sh *handlers
 );
 
+// initialize an arena over a fixed memory region:
+void trex_arena_init(
+    struct trex_arena *arena,
+    void     *mem,
+    uint32_t  size
+);
+
+// allocate fixed memory from the top of the arena; returns 0 if out of memory:
+void *trex_arena_alloc_fixed(struct trex_arena *arena, uint32_t size);
+
+// bytes of arena needed by trex_sm_alloc() for a state machine of the given shape:
+uint32_t trex_sm_block_size(
+    uint8_t      locals_count,
+    uint16_t     handlers_count,
+    uint32_t     code_size
+);
+
+// allocate a single block from ctx->arena holding a state machine's handlers, locals and bytecode.
+// call after trex_sm_init(); locals are zeroed and handlers are reset to empty and unverified:
+enum trex_result trex_sm_alloc(
+    struct trex_context *ctx,
+    struct trex_sm *sm,
+    uint8_t      locals_count,
+    uint16_t     handlers_count,
+    uint32_t     code_size
+);
+
+// allocate a block from ctx->arena holding only an instance's locals; the instance shares the
+// handlers and bytecode of tmpl and has as many locals. call after trex_sm_init():
+enum trex_result trex_sm_alloc_instance(
+    struct trex_context *ctx,
+    struct trex_sm *sm,
+    struct trex_sm *tmpl
+);
+
+// points to the bytecode area of a state machine allocated with trex_sm_alloc():
+uint8_t *trex_sm_code(const struct trex_sm *sm);
+
+// free a state machine's block and compact the blocks after it. the block of a machine whose
+// handlers are shared is kept until its last instance is freed:
+void trex_sm_free(struct trex_context *ctx, struct trex_sm *sm);
+
+// allocate a table of state machines and its name index from ctx->arena:
+enum trex_result trex_machines_alloc(struct trex_context *ctx, unsigned capacity);
+
+// create a stopped state machine with the given name and room for its locals, handlers and bytecode:
+enum trex_result trex_sm_create(
+    struct trex_context *ctx,
+    uint32_t     name,
+    uint8_t      iterations,
+    uint8_t      locals_count,
+    uint16_t     handlers_count,
+    uint32_t     code_size
+);
+
+// create a stopped instance of the template state machine with the given name. the instance shares
+// the template's handlers and bytecode and only adds its own locals and execution state. the
+// template's states cannot be redefined while instances of it exist:
+enum trex_result trex_sm_instance(
+    struct trex_context *ctx,
+    uint32_t     template_name,
+    uint32_t     name,
+    uint8_t      iterations
+);
+
+// find a state machine by name; returns 0 if not found:
+struct trex_sm *trex_sm_find(const struct trex_context *ctx, uint32_t name);
+
+// copy a state handler's bytecode into a stopped state machine's bytecode area. a redefined state
+// reuses its old bytecode if the new code fits there; a state redefined with longer code leaves
+// its old bytecode unused until the machine is deleted:
+enum trex_result trex_sm_define_state(
+    struct trex_context *ctx,
+    uint32_t       name,
+    uint16_t       state,
+    const uint8_t *code,
+    uint32_t       code_size
+);
+
+// set whether a state chains into the next state on RET; see struct trex_sm:
+enum trex_result trex_sm_chain_state(
+    struct trex_context *ctx,
+    uint32_t       name,
+    uint16_t       state,
+    uint8_t        chain
+);
+
+// set a state machine's target latency; see struct trex_sm:
+enum trex_result trex_sm_set_latency(struct trex_context *ctx, uint32_t name, uint32_t latency);
+
+// place a stopped state machine in a session and set its per-slot cycle quota; see struct trex_sm:
+enum trex_result trex_sm_set_quota(struct trex_context *ctx, uint32_t name, uint8_t session, uint32_t quota);
+
+// worst-case cycles of one slot of a verified state machine, from the verifier's handler costs:
+uint32_t trex_sm_slot_cost(const struct trex_sm *sm);
+
+// verify all handlers of a state machine and start running it. refused with RESULT_OVER_BUDGET if
+// a handler could not finish within the machine's quota, or if the worst-case slot costs of the
+// session's running machines would exceed the session budget:
+enum trex_result trex_sm_run(struct trex_context *ctx, uint32_t name);
+
+// stop a state machine; a handler in progress runs to completion first:
+enum trex_result trex_sm_stop(struct trex_context *ctx, uint32_t name);
+
+// delete a state machine and free its memory:
+enum trex_result trex_sm_delete(struct trex_context *ctx, uint32_t name);
+
+#ifdef TREX_STATS
+// copy a state machine's execution counters:
+void trex_sm_stats_snapshot(const struct trex_sm *sm, struct trex_sm_stats *o_stats);
+
+// zero a state machine's execution counters:
+void trex_sm_stats_reset(struct trex_sm *sm);
+#endif
+
+#ifdef TREX_TRACE
+// start recording trace events into a ring of events_count events, which must be a power of two:
+void trex_trace_init(
+    struct trex_context *ctx,
+    struct trex_trace_event *events,
+    uint32_t events_count
+);
+#endif
+
+// bytes needed by trex_snapshot_save(); fixed for a given set of machines, locals and stack size:
+uint32_t trex_snapshot_size(const struct trex_context *ctx);
+
+// serialize the execution state of the context and all its state machines: registers (pc is stored
+// as an offset into the current handler), scheduler position, machine states, locals and the stack.
+// configuration (handlers, syscalls, arena layout) is not included and must match on restore:
+enum trex_result trex_snapshot_save(const struct trex_context *ctx, uint8_t *buf, uint32_t size);
+
+// restore execution state saved by trex_snapshot_save() into an identically configured context:
+enum trex_result trex_snapshot_restore(struct trex_context *ctx, const uint8_t *buf, uint32_t size);
+
+// encode the bytes of curr that differ from base as runs of (skip u16, length u16, bytes) and
+// store the encoded size in o_delta_size; identical snapshots encode as an empty delta of size 0.
+// returns RESULT_OUT_OF_MEMORY if the delta does not fit in out_size:
+enum trex_result trex_snapshot_delta(
+    const uint8_t *base,
+    const uint8_t *curr,
+    uint32_t       size,
+    uint8_t       *out,
+    uint32_t       out_size,
+    uint32_t      *o_delta_size
+);
+
+// apply a delta from trex_snapshot_delta() to a copy of its base snapshot:
+enum trex_result trex_snapshot_apply_delta(
+    uint8_t       *snapshot,
+    uint32_t       size,
+    const uint8_t *delta,
+    uint32_t       delta_size
+);
+
+// run the current state machine's handler for at most the given cycles; returns the cycles left:
+int trex_sm_exec(struct trex_context *ctx, int cycles);
+
 // advance the scheduler to choose the next state machine, then execute the state machine for at most the specified number of cycles:
 void trex_exec(struct trex_context *ctx);
 
+// whether a state machine may be given a slot, for scheduling policies; a machine whose next handler
+// does not fit in what is left of its session's budget must wait for the next trex_exec_at() call:
+int trex_sm_runnable(const struct trex_context *ctx, const struct trex_sm *sm);
+
+// earliest-deadline-first scheduling policy for ctx->schedule. slots go round-robin, except that
+// a machine with a latency target whose deadline would pass during the next round-robin slot runs
+// first; of several such machines the earliest deadline wins. the worst-case latency of a machine
+// is its target plus the longest slot of any other machine:
+struct trex_sm *trex_schedule_edf(struct trex_context *ctx);
+
+// like trex_exec() but at the given host time and with an explicit cycle budget, for hosts that
+// drive execution from emulated time. results depend only on the sequence of calls, so driving
+// trex from emulated events makes execution deterministic across runs:
+void trex_exec_at(struct trex_context *ctx, uint32_t now, int cycles);
+
+// built-in chip syscalls operating on ctx->chips. each transfer is bounds-checked once against
+// the chip size and fails with ERROR_SYSC_INVALID_ARG if any byte is out of range:
+void trex_sys_chip_use(struct trex_context *ctx);                  // (chip) ->
+void trex_sys_chip_address_set(struct trex_context *ctx);          // (addr) ->
+void trex_sys_chip_read_no_advance_byte(struct trex_context *ctx); // -> (byte)
+void trex_sys_chip_read_advance_byte(struct trex_context *ctx);    // -> (byte)
+void trex_sys_chip_read_dword(struct trex_context *ctx);           // -> (dword)
+void trex_sys_chip_write_no_advance_byte(struct trex_context *ctx);// (byte) ->
+void trex_sys_chip_write_advance_byte(struct trex_context *ctx);   // (byte) ->
+void trex_sys_chip_write_dword(struct trex_context *ctx);          // (dword) ->
+void trex_sys_chip_copy(struct trex_context *ctx);                 // (dest chip, dest addr, count) ->
+void trex_sys_chip_diff(struct trex_context *ctx);                 // (local, count) -> (ranges)
+void trex_sys_chip_read_locals(struct trex_context *ctx);          // (local, dwords) ->
+
+// syscall table entries for the built-in chip syscalls, for splicing into a host syscall table:
+#define TREX_CHIP_SYSCALLS \
+    { .name = "chip-use",                   .args = 1, .returns = 0, .cost = 0, .effects = SYSC_CHIP_SELECT,  .call = trex_sys_chip_use }, \
+    { .name = "chip-address-set",           .args = 1, .returns = 0, .cost = 0, .effects = SYSC_CHIP_SELECT,  .call = trex_sys_chip_address_set }, \
+    { .name = "chip-read-no-advance-byte",  .args = 0, .returns = 1, .cost = 0, .effects = SYSC_READS_CHIP,   .call = trex_sys_chip_read_no_advance_byte }, \
+    { .name = "chip-read-advance-byte",     .args = 0, .returns = 1, .cost = 0, .effects = SYSC_READS_CHIP | SYSC_CHIP_SELECT,  .call = trex_sys_chip_read_advance_byte }, \
+    { .name = "chip-read-dword",            .args = 0, .returns = 1, .cost = 1, .effects = SYSC_READS_CHIP | SYSC_CHIP_SELECT,  .call = trex_sys_chip_read_dword }, \
+    { .name = "chip-write-no-advance-byte", .args = 1, .returns = 0, .cost = 0, .effects = SYSC_WRITES_CHIP,  .call = trex_sys_chip_write_no_advance_byte }, \
+    { .name = "chip-write-advance-byte",    .args = 1, .returns = 0, .cost = 0, .effects = SYSC_WRITES_CHIP | SYSC_CHIP_SELECT, .call = trex_sys_chip_write_advance_byte }, \
+    { .name = "chip-write-dword",           .args = 1, .returns = 0, .cost = 1, .effects = SYSC_WRITES_CHIP | SYSC_CHIP_SELECT, .call = trex_sys_chip_write_dword }, \
+    { .name = "chip-copy",                  .args = 3, .returns = 0, .cost = 8, .effects = SYSC_READS_CHIP | SYSC_WRITES_CHIP | SYSC_CHIP_SELECT, .call = trex_sys_chip_copy }, \
+    { .name = "chip-diff",                  .args = 2, .returns = 1, .cost = 8, .effects = SYSC_READS_CHIP | SYSC_MESSAGE, .call = trex_sys_chip_diff }, \
+    { .name = "chip-read-locals",           .args = 2, .returns = 0, .cost = 4, .effects = SYSC_READS_CHIP | SYSC_CHIP_SELECT, .call = trex_sys_chip_read_locals }
+
+// built-in message syscalls; appends fail with ERROR_SYSC_INVALID_ARG once the message would
+// exceed TREX_MESSAGE_SIZE bytes. message-send hands the message to ctx->message_send and
+// returns 1 and clears it if accepted, else returns 0 and keeps it so the handler can retry:
+void trex_sys_message_append_byte(struct trex_context *ctx);       // (byte) ->
+void trex_sys_message_append_word(struct trex_context *ctx);       // (word) ->
+void trex_sys_message_append_dword(struct trex_context *ctx);      // (dword) ->
+void trex_sys_message_send(struct trex_context *ctx);              // -> (sent)
+void trex_sys_message_append_locals(struct trex_context *ctx);     // (local, dwords) ->
+
+// built-in timing syscalls:
+void trex_sys_time_now(struct trex_context *ctx);                  // -> (ctx->now)
+void trex_sys_time_clock(struct trex_context *ctx);                // -> (ctx->clock at the start of the slot)
+
+#define TREX_MESSAGE_SYSCALLS \
+    { .name = "message-append-byte",        .args = 1, .returns = 0, .cost = 0, .effects = SYSC_MESSAGE, .call = trex_sys_message_append_byte }, \
+    { .name = "message-append-word",        .args = 1, .returns = 0, .cost = 0, .effects = SYSC_MESSAGE, .call = trex_sys_message_append_word }, \
+    { .name = "message-append-dword",       .args = 1, .returns = 0, .cost = 1, .effects = SYSC_MESSAGE, .call = trex_sys_message_append_dword }, \
+    { .name = "message-send",               .args = 0, .returns = 1, .cost = 8, .effects = SYSC_MESSAGE | SYSC_MAY_BLOCK, .call = trex_sys_message_send }, \
+    { .name = "message-append-locals",      .args = 2, .returns = 0, .cost = 4, .effects = SYSC_MESSAGE, .call = trex_sys_message_append_locals }
+
+#define TREX_TIME_SYSCALLS \
+    { .name = "time-now",                   .args = 0, .returns = 1, .cost = 0, .effects = SYSC_READS_TIME, .call = trex_sys_time_now }, \
+    { .name = "time-clock",                 .args = 0, .returns = 1, .cost = 0, .effects = SYSC_READS_TIME, .call = trex_sys_time_clock }
+
+// provide storage for the heap of sleeping state machines; trex_machines_alloc() does this
+// from the arena:
+void trex_sleepers_init(struct trex_context *ctx, struct trex_sleeper *sleepers, uint16_t cap);
+
+// earliest wake time of any sleeping state machine, so the host can idle until then. returns 0
+// if no state machine is sleeping:
+int trex_next_wake(const struct trex_context *ctx, uint32_t *o_wake_at);
+
+// built-in sleep syscalls; the machine sleeps once the current handler returns and is skipped by
+// the scheduler until ctx->now reaches the wake time. fails with ERROR_SYSC_INVALID_STATE if the
+// context has no sleeper storage:
+void trex_sys_sleep(struct trex_context *ctx);                     // (ticks) ->
+void trex_sys_sleep_until(struct trex_context *ctx);               // (time) ->
+
+#define TREX_SLEEP_SYSCALLS \
+    { .name = "sleep",                      .args = 1, .returns = 0, .cost = 0, .effects = SYSC_READS_TIME | SYSC_MAY_BLOCK, .call = trex_sys_sleep }, \
+    { .name = "sleep-until",                .args = 1, .returns = 0, .cost = 0, .effects = SYSC_READS_TIME | SYSC_MAY_BLOCK, .call = trex_sys_sleep_until }
+
+// set up an empty channel over a ring of cap values; cap must be a power of two up to 0x8000:
+void trex_channel_init(struct trex_channel *ch, uint32_t *buf, uint16_t cap);
+
+// built-in channel syscalls on ctx->channels. send returns 0 and drops nothing if the channel is
+// full; receive returns the oldest value and 1, or 0 and 0 if the channel is empty. wait makes the
+// machine WAITING once its handler returns if the channel is still empty, and a send to the
+// channel readies it; each channel has at most one waiting consumer:
+void trex_sys_channel_send(struct trex_context *ctx);              // (channel, value) -> (sent)
+void trex_sys_channel_receive(struct trex_context *ctx);           // (channel) -> (value, received)
+void trex_sys_channel_wait(struct trex_context *ctx);              // (channel) ->
+
+#define TREX_CHANNEL_SYSCALLS \
+    { .name = "channel-send",               .args = 2, .returns = 1, .cost = 1, .effects = SYSC_MESSAGE, .call = trex_sys_channel_send }, \
+    { .name = "channel-receive",            .args = 1, .returns = 2, .cost = 1, .effects = SYSC_MESSAGE, .call = trex_sys_channel_receive }, \
+    { .name = "channel-wait",               .args = 1, .returns = 0, .cost = 0, .effects = SYSC_MAY_BLOCK, .call = trex_sys_channel_wait }
+
+// the whole standard syscall library; chip syscalls are numbered from 0 as in the README:
+#define TREX_STD_SYSCALLS \
+    TREX_CHIP_SYSCALLS, \
+    TREX_MESSAGE_SYSCALLS, \
+    TREX_TIME_SYSCALLS, \
+    TREX_SLEEP_SYSCALLS, \
+    TREX_CHANNEL_SYSCALLS
+
 // for syscall usage; push a value onto the stack:
 void trex_push(struct trex_context *ctx, uint32_t val);
 // for syscall usage; pop a value off the stack:
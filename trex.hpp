@@ -0,0 +1,48 @@
+#pragma once
+
+// header-only front end that specializes the interpreter for a syscall table known at compile
+// time, e.g. in an emulator that links its syscalls in. each syscall instruction becomes a switch
+// of direct calls that the compiler can inline instead of a call through ctx->syscalls.
+//
+// the interpreter body is the one trex_sm_exec() uses (trex_interp.h), so both behave the same;
+// trex.h stays the portable C API.
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <utility>
+
+extern "C" {
+#include "trex.h"
+#include "trex_opcodes.h"
+#include "trex_impl.h"
+}
+
+// call syscall x of the table; the verifier has checked that x is in range:
+template <const auto &Syscalls, std::size_t... I>
+inline void trex_static_call(struct trex_context *ctx, uint16_t x, std::index_sequence<I...>) {
+    (void)((x == I && (Syscalls[I].call(ctx), true)) || ...);
+}
+
+// trex_sm_exec() specialized for a constexpr syscall table:
+template <const auto &Syscalls>
+int trex_sm_exec_static(struct trex_context *ctx, int cycles) {
+#define TREX_INTERP_SYSCALLS Syscalls
+#define TREX_INTERP_CALL(x, s) trex_static_call<Syscalls>(ctx, x, std::make_index_sequence<std::size(Syscalls)>{})
+#include "trex_interp.h"
+#undef TREX_INTERP_CALL
+#undef TREX_INTERP_SYSCALLS
+}
+
+// trex_context_init() with a constexpr syscall table, running handlers with trex_sm_exec_static():
+template <const auto &Syscalls>
+void trex_context_init_static(
+    struct trex_context *ctx,
+    void *hostdata,
+    uint32_t *stack,
+    unsigned stack_size,
+    int cycles_per_exec
+) {
+    trex_context_init(ctx, hostdata, stack, stack_size, cycles_per_exec, (uint16_t)std::size(Syscalls), Syscalls);
+    ctx->exec = trex_sm_exec_static<Syscalls>;
+}
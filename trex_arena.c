@@ -0,0 +1,270 @@
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#include "trex.h"
+
+// every allocation is aligned so that pointers and uint32_t values can be placed in it:
+#define TREX_ARENA_ALIGN 8u
+#define align_up(n) (((n) + (TREX_ARENA_ALIGN - 1u)) & ~(TREX_ARENA_ALIGN - 1u))
+
+static void trex_arena_update_high_water(struct trex_arena *arena) {
+    uint32_t used = arena->lo + arena->hi;
+    if (used > arena->high_water) {
+        arena->high_water = used;
+    }
+}
+
+void trex_arena_init(
+    struct trex_arena *arena,
+    void     *mem,
+    uint32_t  size
+) {
+    // align the region start and trim the size to a multiple of the alignment:
+    uintptr_t start = ((uintptr_t)mem + (TREX_ARENA_ALIGN - 1u)) & ~(uintptr_t)(TREX_ARENA_ALIGN - 1u);
+    uint32_t  skip = (uint32_t)(start - (uintptr_t)mem);
+
+    arena->base = (uint8_t *)start;
+    arena->size = (size > skip) ? ((size - skip) & ~(TREX_ARENA_ALIGN - 1u)) : 0;
+    arena->lo = 0;
+    arena->hi = 0;
+    arena->high_water = 0;
+}
+
+void *trex_arena_alloc_fixed(struct trex_arena *arena, uint32_t size) {
+    size = align_up(size);
+    if (size > arena->size - arena->lo - arena->hi) {
+        return 0;
+    }
+
+    arena->hi += size;
+    trex_arena_update_high_water(arena);
+
+    return arena->base + arena->size - arena->hi;
+}
+
+// block layout: header, handlers, locals, bytecode:
+static uint32_t handlers_offset(void) {
+    return align_up(sizeof(struct trex_block));
+}
+
+static uint32_t locals_offset(uint16_t handlers_count) {
+    return handlers_offset() + align_up(handlers_count * sizeof(struct trex_sh));
+}
+
+static uint32_t code_offset(uint8_t locals_count, uint16_t handlers_count) {
+    return locals_offset(handlers_count) + align_up(locals_count * sizeof(uint32_t));
+}
+
+uint32_t trex_sm_block_size(
+    uint8_t      locals_count,
+    uint16_t     handlers_count,
+    uint32_t     code_size
+) {
+    return code_offset(locals_count, handlers_count) + align_up(code_size);
+}
+
+enum trex_result trex_sm_alloc(
+    struct trex_context *ctx,
+    struct trex_sm *sm,
+    uint8_t      locals_count,
+    uint16_t     handlers_count,
+    uint32_t     code_size
+) {
+    struct trex_arena *arena = ctx->arena;
+    if (!arena) {
+        return RESULT_OUT_OF_MEMORY;
+    }
+
+    uint32_t size = trex_sm_block_size(locals_count, handlers_count, code_size);
+    if (size > arena->size - arena->lo - arena->hi) {
+        return RESULT_OUT_OF_MEMORY;
+    }
+
+    uint8_t *p = arena->base + arena->lo;
+    arena->lo += size;
+    trex_arena_update_high_water(arena);
+
+    struct trex_block *block = (struct trex_block *)p;
+    block->size = size;
+    block->owner = sm;
+
+    sm->block = block;
+    sm->tmpl = 0;
+    sm->refs = 1;
+    sm->handlers_count = handlers_count;
+    sm->handlers = (struct trex_sh *)(p + handlers_offset());
+    sm->locals_count = locals_count;
+    sm->locals = (uint32_t *)(p + locals_offset(handlers_count));
+    sm->exec_status = NOT_EXECUTABLE;
+
+    uint8_t *code = p + code_offset(locals_count, handlers_count);
+    memset(sm->locals, 0, locals_count * sizeof(uint32_t));
+    memset(sm->handlers, 0, handlers_count * sizeof(struct trex_sh));
+    for (unsigned i = 0; i < handlers_count; i++) {
+        sm->handlers[i].verify_status = UNVERIFIED;
+        sm->handlers[i].pc_start = code;
+        sm->handlers[i].pc_end = code;
+    }
+
+    return RESULT_OK;
+}
+
+enum trex_result trex_sm_alloc_instance(
+    struct trex_context *ctx,
+    struct trex_sm *sm,
+    struct trex_sm *tmpl
+) {
+    struct trex_arena *arena = ctx->arena;
+    if (!arena) {
+        return RESULT_OUT_OF_MEMORY;
+    }
+    // instances of an instance share the original handlers:
+    if (tmpl->tmpl) {
+        tmpl = tmpl->tmpl;
+    }
+
+    // an instance block has no handlers or bytecode of its own:
+    uint32_t size = trex_sm_block_size(tmpl->locals_count, 0, 0);
+    if (size > arena->size - arena->lo - arena->hi) {
+        return RESULT_OUT_OF_MEMORY;
+    }
+
+    uint8_t *p = arena->base + arena->lo;
+    arena->lo += size;
+    trex_arena_update_high_water(arena);
+
+    struct trex_block *block = (struct trex_block *)p;
+    block->size = size;
+    block->owner = sm;
+
+    sm->block = block;
+    sm->tmpl = tmpl;
+    sm->refs = 1;
+    tmpl->refs++;
+    sm->handlers_count = tmpl->handlers_count;
+    sm->handlers = tmpl->handlers;
+    sm->chain = tmpl->chain;
+    sm->locals_count = tmpl->locals_count;
+    sm->locals = (uint32_t *)(p + locals_offset(0));
+    sm->exec_status = NOT_EXECUTABLE;
+    memset(sm->locals, 0, sm->locals_count * sizeof(uint32_t));
+
+    return RESULT_OK;
+}
+
+uint8_t *trex_sm_code(const struct trex_sm *sm) {
+    if (!sm->block || sm->tmpl) {
+        return 0;
+    }
+    return (uint8_t *)sm->block + code_offset(sm->locals_count, sm->handlers_count);
+}
+
+// moves a pointer by delta if it points within [lo, hi]:
+#define relocate(p, lo, hi, delta) \
+    if ((uint8_t *)(p) >= (lo) && (uint8_t *)(p) <= (hi)) { (p) = (void *)((uint8_t *)(p) - (delta)); }
+
+// fix up all pointers of a state machine whose block moved down by delta bytes from within [lo, hi]:
+static void trex_sm_relocate(
+    struct trex_sm *sm,
+    uint8_t *lo,
+    uint8_t *hi,
+    uint32_t delta
+) {
+    relocate(sm->block, lo, hi, delta);
+    relocate(sm->locals, lo, hi, delta);
+
+    // shared handlers are fixed up once, with the template's block:
+    if (sm->tmpl) {
+        return;
+    }
+    relocate(sm->handlers, lo, hi, delta);
+
+    for (unsigned i = 0; i < sm->handlers_count; i++) {
+        struct trex_sh *sh = &sm->handlers[i];
+        relocate(sh->pc_start, lo, hi, delta);
+        relocate(sh->pc_end, lo, hi, delta);
+        relocate(sh->invalid_pc, lo, hi, delta);
+        relocate(sh->invalid_target_pc, lo, hi, delta);
+    }
+}
+
+// free a block and compact the blocks after it:
+static void block_free(struct trex_context *ctx, struct trex_sm *sm) {
+    struct trex_arena *arena = ctx->arena;
+    struct trex_block *block = sm->block;
+
+    uint8_t *start = (uint8_t *)block;
+    uint32_t size = block->size;
+    uint8_t *end = start + size;
+    uint8_t *top = arena->base + arena->lo;
+
+    sm->block = 0;
+    sm->tmpl = 0;
+    sm->refs = 0;
+    sm->handlers_count = 0;
+    sm->handlers = 0;
+    sm->locals_count = 0;
+    sm->locals = 0;
+    sm->exec_status = NOT_EXECUTABLE;
+    if (ctx->sm == sm) {
+        ctx->sm = 0;
+    }
+
+    // compact: slide every block after the freed one down and fix up their owners:
+    if (end < top) {
+        memmove(start, end, top - end);
+        for (uint8_t *p = start; p < top - size; p += ((struct trex_block *)p)->size) {
+            trex_sm_relocate(((struct trex_block *)p)->owner, end, top, size);
+        }
+
+        // instances follow their template's handlers wherever the instance's own block is:
+        for (unsigned i = 0; i < ctx->machines_count; i++) {
+            if (ctx->machines[i].tmpl) {
+                relocate(ctx->machines[i].handlers, end, top, size);
+            }
+        }
+
+        // the current machine may be suspended in the middle of a handler:
+        relocate(ctx->pc, end, top, size);
+        relocate(ctx->loop_pc, end, top, size);
+    }
+
+    arena->lo -= size;
+}
+
+#undef relocate
+
+void trex_sm_free(struct trex_context *ctx, struct trex_sm *sm) {
+    if (!ctx->arena || !sm->block) {
+        return;
+    }
+
+    // instances still run the handlers; the machine stops but its block stays:
+    if (sm->refs > 1) {
+        sm->refs--;
+        sm->exec_status = NOT_EXECUTABLE;
+        if (ctx->sm == sm) {
+            ctx->sm = 0;
+        }
+        return;
+    }
+
+    struct trex_sm *tmpl = sm->tmpl;
+    block_free(ctx, sm);
+
+    // the last instance of an already freed template frees the template's block:
+    if (tmpl && --tmpl->refs == 0) {
+        block_free(ctx, tmpl);
+    }
+}
+
+#undef align_up
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,330 @@
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <vector>
+
+extern "C" {
+#include "trex.h"
+#include "trex_opcodes.h"
+}
+
+#include "trex_pool.hpp"
+#include "trex.hpp"
+
+// a busy state handler: sums a few locals and bumps a counter, no syscalls:
+static uint8_t busy_code[] = {
+    LDL1, 0,
+    PSHA,
+    LDL1, 1,
+    ADD,
+    PSHA,
+    LDL1, 2,
+    XOR,
+    STL1, 1,
+    LDL1, 0,
+    PSHA,
+    IMM1, 1,
+    ADD,
+    STL1, 0,
+    RET,
+};
+
+// one emulated console's worth of trex state:
+struct console {
+    struct trex_context ctx;
+    struct trex_sm      machines[4];
+    struct trex_sh      handlers[4][1];
+    uint32_t            locals[4][4];
+    uint32_t            stack[16];
+
+    console() {
+        memset(locals, 0, sizeof(locals));
+        trex_context_init(&ctx, this, stack, 16, 1024, 0, nullptr);
+        ctx.machines_count = 4;
+        ctx.machines = machines;
+        for (int m = 0; m < 4; m++) {
+            trex_sm_init(&ctx, &machines[m], 1 + m, 4, locals[m]);
+            handlers[m][0].pc_start = busy_code;
+            handlers[m][0].pc_end = busy_code + sizeof(busy_code);
+            handlers[m][0].verify_status = UNVERIFIED;
+            trex_sm_verify(&ctx, &machines[m], 1, handlers[m]);
+        }
+    }
+};
+
+static double bench_pool(unsigned workers, unsigned contexts, unsigned frames) {
+    std::vector<std::unique_ptr<console>> consoles;
+    std::vector<struct trex_context *> ctxs;
+    for (unsigned i = 0; i < contexts; i++) {
+        consoles.push_back(std::make_unique<console>());
+        ctxs.push_back(&consoles.back()->ctx);
+    }
+
+    trex_pool pool(workers);
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (unsigned f = 0; f < frames; f++) {
+        pool.exec_frame(ctxs);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+
+    // context-frames per second:
+    return (double)contexts * frames / std::chrono::duration<double>(t1 - t0).count();
+}
+
+// decode a packed value in local 0 into a 6-bit field and a byte-swapped copy, the slow way:
+static uint8_t decode_old_code[] = {
+    // (x >> 5) & 0x3F:
+    LDL1, 0, PSHA, IMM1, 5, SHRU, PSHA, IMM1, 0x3F, AND, STL1, 1,
+    // byte-swap x:
+    LDL1, 0, PSHA, IMM1, 24, SHRU, STL1, 2,
+    LDL1, 0, PSHA, IMM1, 8, SHRU, PSHA, IMM2, 0x00, 0xFF, AND, PSHA, LDL1, 2, OR, STL1, 2,
+    LDL1, 0, PSHA, IMM1, 8, SHL, PSHA, IMM3, 0x00, 0x00, 0xFF, AND, PSHA, LDL1, 2, OR, STL1, 2,
+    LDL1, 0, PSHA, IMM1, 24, SHL, PSHA, LDL1, 2, OR, STL1, 2,
+    RET,
+};
+
+// the same with bitfield and byte-swap opcodes:
+static uint8_t decode_new_code[] = {
+    LDL1, 0, BEXT, 5, 6, STL1, 1,
+    LDL1, 0, BSWAP, STL1, 2,
+    RET,
+};
+
+// local 2 = ((l0 + l1) * (l0 - l1)) ^ l0 with the accumulator and stack:
+static uint8_t arith_stack_code[] = {
+    LDL1, 0, PSHA, LDL1, 1, ADD, PSHA,
+    LDL1, 0, PSHA, LDL1, 1, SUB,
+    MUL, PSHA, LDL1, 0, XOR, STL1, 2,
+    RET,
+};
+
+// the same with registers:
+static uint8_t arith_register_code[] = {
+    LDLR, 0, 0, LDLR, 1, 1,
+    MOVR, 0x20, ADDR, 0x21,
+    MOVR, 0x30, SUBR, 0x31,
+    MULR, 0x23, XORR, 0x20, STLR, 2, 2,
+    RET,
+};
+
+// nanoseconds per handler run and the handler's instruction count:
+static double bench_handler(uint8_t *code, uint32_t size, uint32_t &o_instructions) {
+    struct trex_context ctx;
+    struct trex_sm      sm;
+    struct trex_sh      sh = {};
+    uint32_t            locals[4] = {0x12345678};
+    uint32_t            stack[8];
+
+    trex_context_init(&ctx, nullptr, stack, 8, 0, 0, nullptr);
+    ctx.machines_count = 1;
+    ctx.machines = &sm;
+    trex_sm_init(&ctx, &sm, 1, 4, locals);
+    sh.pc_start = code;
+    sh.pc_end = code + size;
+    trex_sm_verify(&ctx, &sm, 1, &sh);
+
+    // exactly one handler run per exec:
+    o_instructions = sh.max_cost;
+    ctx.cycles_per_exec = sh.max_cost;
+
+    const unsigned runs = 2000000;
+    auto t0 = std::chrono::steady_clock::now();
+    for (unsigned r = 0; r < runs; r++) {
+        trex_exec(&ctx);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::nano>(t1 - t0).count() / runs;
+}
+
+// emulated memory read by the host syscall below:
+static uint8_t peek_mem[64];
+
+// a host syscall defined where the table is, as an emulator would link its own in:
+static void sys_peek(struct trex_context *ctx) {
+    uint32_t addr;
+    trex_pop(ctx, &addr);
+    trex_push(ctx, peek_mem[addr & 63]);
+}
+
+static constexpr struct trex_syscall peek_syscalls[] = {
+    { .name = "peek", .args = 1, .returns = 1, .cost = 0, .effects = SYSC_READS_CHIP, .call = sys_peek },
+};
+
+// a syscall-heavy state handler: gathers bytes from emulated memory into a sum:
+static uint8_t gather_code[] = {
+    PSH1, 0x10, SYS1, 0, POP, STL1, 0,
+    PSH1, 0x11, SYS1, 0, POP, PSHA, LDL1, 0, ADD, STL1, 0,
+    PSH1, 0x12, SYS1, 0, POP, PSHA, LDL1, 0, ADD, STL1, 0,
+    PSH1, 0x13, SYS1, 0, POP, PSHA, LDL1, 0, ADD, STL1, 0,
+    PSH1, 0x20, SYS1, 0, POP, PSHA, LDL1, 0, ADD, STL1, 0,
+    PSH1, 0x21, SYS1, 0, POP, PSHA, LDL1, 0, ADD, STL1, 0,
+    RET,
+};
+
+// nanoseconds per run of the gather handler, with or without the specialized interpreter:
+static double bench_syscalls(bool specialized) {
+    struct trex_context ctx;
+    struct trex_sm      sm;
+    struct trex_sh      sh = {};
+    uint32_t            locals[4] = {};
+    uint32_t            stack[8];
+
+    if (specialized) {
+        trex_context_init_static<peek_syscalls>(&ctx, nullptr, stack, 8, 0);
+    } else {
+        trex_context_init(&ctx, nullptr, stack, 8, 0, 1, peek_syscalls);
+    }
+    ctx.machines_count = 1;
+    ctx.machines = &sm;
+    trex_sm_init(&ctx, &sm, 1, 4, locals);
+    sh.pc_start = gather_code;
+    sh.pc_end = gather_code + sizeof(gather_code);
+    trex_sm_verify(&ctx, &sm, 1, &sh);
+
+    // exactly one handler run per exec:
+    ctx.cycles_per_exec = sh.max_cost;
+
+    const unsigned runs = 2000000;
+    auto t0 = std::chrono::steady_clock::now();
+    for (unsigned r = 0; r < runs; r++) {
+        trex_exec(&ctx);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::nano>(t1 - t0).count() / runs;
+}
+
+// cycles between consecutive slots of the latency-critical machine:
+struct latency_stats {
+    uint32_t last;
+    uint32_t worst;
+    uint64_t total;
+    uint32_t runs;
+};
+
+static void sys_mark(struct trex_context *ctx) {
+    latency_stats *l = (latency_stats *)ctx->hostdata;
+    uint32_t gap = ctx->clock - l->last;
+    if (l->runs && gap > l->worst) {
+        l->worst = gap;
+    }
+    l->total += l->runs ? gap : 0;
+    l->last = ctx->clock;
+    l->runs++;
+}
+
+// one latency-critical machine that only marks its slot, against bulk machines:
+static uint8_t mark_code[] = {
+    SYS1, 0,
+    RET,
+};
+
+// worst-case response latency of one critical machine under the given policy:
+static latency_stats bench_latency(struct trex_sm *(*schedule)(struct trex_context *), unsigned bulk) {
+    static const struct trex_syscall syscalls[] = {
+        { .name = "mark", .args = 0, .returns = 0, .cost = 0, .effects = SYSC_HOST, .call = sys_mark },
+    };
+
+    latency_stats l = {};
+    struct trex_context ctx;
+    std::vector<struct trex_sm> machines(bulk + 1);
+    std::vector<struct trex_sh> handlers(bulk + 1);
+    std::vector<uint32_t> locals((bulk + 1) * 4);
+    uint32_t stack[16];
+
+    trex_context_init(&ctx, &l, stack, 16, 1024, 1, syscalls);
+    ctx.machines_count = bulk + 1;
+    ctx.machines = machines.data();
+    ctx.schedule = schedule;
+    for (unsigned m = 0; m <= bulk; m++) {
+        uint8_t *code = m ? busy_code : mark_code;
+        uint32_t size = m ? sizeof(busy_code) : sizeof(mark_code);
+        handlers[m] = {};
+        handlers[m].pc_start = code;
+        handlers[m].pc_end = code + size;
+        // bulk machines get longer bursts, as a telemetry poller would:
+        trex_sm_init(&ctx, &machines[m], m ? 4 : 1, 4, &locals[m * 4]);
+        trex_sm_verify(&ctx, &machines[m], 1, &handlers[m]);
+        machines[m].latency = m ? 4096 : 64;
+        machines[m].deadline = machines[m].latency;
+    }
+
+    for (unsigned f = 0; f < 2000; f++) {
+        trex_exec(&ctx);
+    }
+    return l;
+}
+
+int main() {
+    struct {
+        const char *name;
+        uint8_t    *code;
+        uint32_t    size;
+    } handlers[] = {
+        {"decode, shift/mask ops", decode_old_code,     sizeof(decode_old_code)},
+        {"decode, bitfield ops",   decode_new_code,     sizeof(decode_new_code)},
+        {"arith, stack",           arith_stack_code,    sizeof(arith_stack_code)},
+        {"arith, registers",       arith_register_code, sizeof(arith_register_code)},
+    };
+    std::cout << "handlers: instructions, ns per run" << std::endl;
+    for (auto &h : handlers) {
+        uint32_t instructions;
+        double ns = bench_handler(h.code, h.size, instructions);
+        std::cout << "  " << std::left << std::setw(24) << h.name << std::right
+            << std::setw(4) << instructions
+            << std::setw(9) << std::fixed << std::setprecision(1) << ns << std::endl;
+    }
+    std::cout << std::endl;
+
+    std::cout << "syscalls: ns per run of a host-syscall gather handler" << std::endl;
+    std::cout << "  table lookup  " << std::setw(9) << std::setprecision(1) << bench_syscalls(false) << std::endl;
+    std::cout << "  specialized   " << std::setw(9) << std::setprecision(1) << bench_syscalls(true) << std::endl;
+    std::cout << std::endl;
+
+    std::cout << "scheduling: critical machine latency in cycles, worst and mean" << std::endl;
+    for (unsigned bulk : {3u, 15u, 63u}) {
+        latency_stats rr = bench_latency(nullptr, bulk);
+        latency_stats edf = bench_latency(trex_schedule_edf, bulk);
+        std::cout << "  " << std::setw(2) << bulk << " bulk machines: round-robin "
+            << std::setw(5) << rr.worst << std::setw(7) << std::setprecision(1) << (double)rr.total / (rr.runs - 1)
+            << ", edf " << std::setw(5) << edf.worst << std::setw(7) << (double)edf.total / (edf.runs - 1) << std::endl;
+    }
+    std::cout << std::endl;
+
+    unsigned hw = std::thread::hardware_concurrency();
+    if (hw == 0) {
+        hw = 1;
+    }
+
+    std::cout << "trex_pool: context-frames/sec (1024 cycles per frame)" << std::endl;
+    std::cout << std::setw(9) << "contexts";
+    for (unsigned w = 1; w <= hw; w *= 2) {
+        std::cout << std::setw(12) << (std::to_string(w) + " workers");
+    }
+    std::cout << std::setw(10) << "speedup" << std::endl;
+
+    for (unsigned contexts = 1; contexts <= 1024; contexts *= 4) {
+        const unsigned frames = 20000 / contexts + 20;
+
+        std::cout << std::setw(9) << contexts;
+        double base = 0, best = 0;
+        for (unsigned w = 1; w <= hw; w *= 2) {
+            double rate = bench_pool(w, contexts, frames);
+            if (w == 1) {
+                base = rate;
+            }
+            if (rate > best) {
+                best = rate;
+            }
+            std::cout << std::setw(12) << std::fixed << std::setprecision(0) << rate;
+        }
+        std::cout << std::setw(9) << std::setprecision(2) << best / base << "x" << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,258 @@
+#pragma once
+
+// header-only assembler and verifier for state handlers built into the host, e.g. firmware or
+// emulator machines. handlers are assembled with labels instead of hand-computed branch offsets
+// and verified at compile time by the same verifier trex_sm_verify() uses (trex_verifier.h), so
+// invalid code fails the build and the handlers skip verification at startup:
+//
+//   constexpr trex_builder<> build_poll() {
+//       enum { done };
+//       trex_builder<> b;
+//       b.sys(2).op(POP).bz(done);          // chip-read-no-advance-byte
+//       b.sys(14).op(POP);                  // message-send
+//       b.label(done).op(RET);
+//       return b;
+//   }
+//
+//   static constexpr struct trex_static_env env = { ... };
+//   using poll = trex_static_handler<build_poll, env>;
+//
+//   struct trex_sh handlers[] = { poll::sh() };
+//   trex_sm_preverified(&env, ctx, sm, 1, handlers);
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+extern "C" {
+#include "trex.h"
+#include "trex_opcodes.h"
+#include "trex_impl.h"
+#include "trex_verifier.h"
+}
+
+// assembles handler bytecode into a fixed-capacity buffer. branch and loop targets are labels,
+// numbered from 0, and must lie ahead of the branch; offsets are filled in as labels are placed.
+// misuse such as a backward branch, an offset over 255 or running out of room sets error, which
+// fails trex_assemble():
+template <std::size_t Cap = 1024, unsigned Labels = 32>
+struct trex_builder {
+    uint8_t  code[Cap] = {};
+    uint32_t size = 0;
+    bool     error = false;
+
+    // label positions, or -1 if not placed yet:
+    int32_t  labels[Labels];
+    // offset bytes waiting for a label; `label` is Labels once resolved:
+    struct fixup {
+        uint32_t at;
+        unsigned label;
+    };
+    fixup    fixups[Labels * 4] = {};
+    unsigned fixups_count = 0;
+
+    constexpr trex_builder() {
+        for (unsigned l = 0; l < Labels; l++) {
+            labels[l] = -1;
+        }
+    }
+
+    constexpr trex_builder &u8(uint32_t x) {
+        if (size >= Cap) {
+            error = true;
+            return *this;
+        }
+        code[size++] = (uint8_t)x;
+        return *this;
+    }
+
+    constexpr trex_builder &u16(uint32_t x) { return u8(x).u8(x >> 8); }
+    constexpr trex_builder &u24(uint32_t x) { return u16(x).u8(x >> 16); }
+    constexpr trex_builder &u32(uint32_t x) { return u16(x).u16(x >> 16); }
+
+    // opcode with no operand, or with operands appended by u8() etc:
+    constexpr trex_builder &op(uint8_t i) { return u8(i); }
+
+    // shortest encodings of opcodes with an 8 or 16-bit and a wider variant:
+    constexpr trex_builder &sys(uint32_t x) { return x > 0xFF ? op(SYS2).u16(x) : op(SYS1).u8(x); }
+    constexpr trex_builder &ldl(uint32_t x) { return x > 0xFF ? op(LDL2).u16(x) : op(LDL1).u8(x); }
+    constexpr trex_builder &stl(uint32_t x) { return x > 0xFF ? op(STL2).u16(x) : op(STL1).u8(x); }
+    constexpr trex_builder &sst(uint32_t x) { return x > 0xFF ? op(SST2).u16(x) : op(SST1).u8(x); }
+    constexpr trex_builder &ldc(uint32_t x) { return x > 0xFF ? op(LDC2).u16(x) : op(LDC1).u8(x); }
+
+    constexpr trex_builder &imm(uint32_t x) {
+        if (x <= 0xFF)     return op(IMM1).u8(x);
+        if (x <= 0xFFFF)   return op(IMM2).u16(x);
+        if (x <= 0xFFFFFF) return op(IMM3).u24(x);
+        return op(IMM4).u32(x);
+    }
+
+    constexpr trex_builder &psh(uint32_t x) {
+        if (x <= 0xFF)     return op(PSH1).u8(x);
+        if (x <= 0xFFFF)   return op(PSH2).u16(x);
+        if (x <= 0xFFFFFF) return op(PSH3).u24(x);
+        return op(PSH4).u32(x);
+    }
+
+    constexpr trex_builder &bz(unsigned l)  { return op(BZ).target(l); }
+    constexpr trex_builder &bnz(unsigned l) { return op(BNZ).target(l); }
+
+    // loop of at most cap iterations whose LPE is placed right before label l:
+    constexpr trex_builder &lps(uint8_t cap, unsigned l) { return op(LPS).u8(cap).target(l); }
+
+    // place label l at the next opcode:
+    constexpr trex_builder &label(unsigned l) {
+        if (l >= Labels || labels[l] >= 0) {
+            error = true;
+            return *this;
+        }
+        labels[l] = (int32_t)size;
+        for (unsigned f = 0; f < fixups_count; f++) {
+            if (fixups[f].label != l) {
+                continue;
+            }
+            const uint32_t offs = size - (fixups[f].at + 1);
+            if (offs > 0xFF) {
+                error = true;
+            }
+            code[fixups[f].at] = (uint8_t)offs;
+            fixups[f].label = Labels;
+        }
+        return *this;
+    }
+
+    // every branch has reached its label:
+    constexpr bool complete() const {
+        for (unsigned f = 0; f < fixups_count; f++) {
+            if (fixups[f].label != Labels) {
+                return false;
+            }
+        }
+        return !error;
+    }
+
+private:
+    // offset byte of a forward branch to label l:
+    constexpr trex_builder &target(unsigned l) {
+        if (l >= Labels || labels[l] >= 0 || fixups_count >= Labels * 4) {
+            // unknown label, or a backward branch:
+            error = true;
+            return *this;
+        }
+        fixups[fixups_count++] = { size, l };
+        return u8(0);
+    }
+};
+
+// bytecode of the handler assembled by Build, sized to fit:
+template <auto Build>
+constexpr auto trex_assemble() {
+    constexpr auto b = Build();
+    static_assert(b.complete(), "state handler has a bad or unplaced branch label");
+    std::array<uint8_t, b.size> code = {};
+    for (uint32_t n = 0; n < b.size; n++) {
+        code[n] = b.code[n];
+    }
+    return code;
+}
+
+// the context and machine that handlers are verified against at compile time. a machine running
+// pre-verified handlers must be set up with the same syscall table and constant pool, and at
+// least as much stack, locals and states:
+struct trex_static_env {
+    uint16_t                   syscalls_count;
+    const struct trex_syscall *syscalls;
+    uint16_t                   consts_count;
+    const uint32_t            *consts;
+    uint32_t                   stack_size;
+    uint8_t                    locals_count;
+    uint16_t                   handlers_count;
+};
+
+// verification results of trex_static_verify(); PCs are offsets into the bytecode:
+struct trex_static_result {
+    enum verify_status verify_status;
+    uint32_t invalid_pc;
+    uint32_t max_cost;
+    uint8_t  effects;
+};
+
+// run the verifier over bytecode at compile time:
+template <std::size_t N>
+constexpr struct trex_static_result trex_static_verify(
+    const std::array<uint8_t, N> &code,
+    const struct trex_static_env &env
+) {
+    // room for branch targets past the end, which the verifier computes before rejecting them:
+    uint8_t bytes[N + 0x102] = {};
+    for (std::size_t n = 0; n < N; n++) {
+        bytes[n] = code[n];
+    }
+    uint32_t locals[1] = {};
+
+    struct trex_context ctx = {};
+    ctx.syscalls_count = env.syscalls_count;
+    ctx.syscalls = env.syscalls;
+    ctx.consts_count = env.consts_count;
+    ctx.consts = env.consts;
+
+    struct trex_sm sm = {};
+    sm.locals_count = env.locals_count;
+    sm.locals = locals;
+    sm.handlers_count = env.handlers_count;
+
+    struct trex_sh sh = {};
+    sh.pc_start = bytes;
+    sh.pc_end = bytes + N;
+    trex_sh_verify(&ctx, &sm, &sh, (long)env.stack_size);
+
+    struct trex_static_result r = {};
+    r.verify_status = sh.verify_status;
+    r.invalid_pc = sh.verify_status == VERIFIED ? 0 : (uint32_t)(sh.invalid_pc - sh.pc_start);
+    r.max_cost = sh.max_cost;
+    r.effects = sh.effects;
+    return r;
+}
+
+// a handler assembled by Build and verified against Env at compile time; the build fails if it
+// does not verify:
+template <auto Build, const struct trex_static_env &Env>
+struct trex_static_handler {
+    static constexpr auto code = trex_assemble<Build>();
+    static constexpr struct trex_static_result result = trex_static_verify(code, Env);
+    static_assert(result.verify_status == VERIFIED, "state handler fails verification");
+
+    // a handler that trex_sm_verify() accepts without verifying it again. handlers never write
+    // their bytecode, so it can stay in read-only memory:
+    static struct trex_sh sh() {
+        struct trex_sh sh = {};
+        sh.verify_status = VERIFIED;
+        sh.max_cost = result.max_cost;
+        sh.effects = result.effects;
+        sh.pc_start = const_cast<uint8_t *>(code.data());
+        sh.pc_end = sh.pc_start + code.size();
+        return sh;
+    }
+};
+
+// trex_sm_verify() for handlers verified against env at compile time. if the machine is not set
+// up as env describes, the handlers are verified again at runtime instead:
+inline void trex_sm_preverified(
+    const struct trex_static_env *env,
+    const struct trex_context *ctx,
+    struct trex_sm *sm,
+    const uint16_t  handlers_count,
+    struct trex_sh *handlers
+) {
+    const bool matches = ctx->syscalls_count == env->syscalls_count && ctx->syscalls == env->syscalls
+        && ctx->consts_count == env->consts_count && ctx->consts == env->consts
+        && (uint32_t)(ctx->stack_max - ctx->stack_min) >= env->stack_size
+        && sm->locals_count >= env->locals_count
+        && handlers_count >= env->handlers_count;
+    if (!matches) {
+        for (uint16_t i = 0; i < handlers_count; i++) {
+            handlers[i].verify_status = UNVERIFIED;
+        }
+    }
+    trex_sm_verify(ctx, sm, handlers_count, handlers);
+}
@@ -0,0 +1,124 @@
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "trex.h"
+#include "trex_impl.h"
+
+void trex_channel_init(struct trex_channel *ch, uint32_t *buf, uint16_t cap) {
+    ch->buf = buf;
+    ch->mask = (uint16_t)(cap - 1);
+    ch->head = 0;
+    ch->tail = 0;
+    ch->waiter = 0;
+}
+
+// the channel named by a syscall argument, else fail the syscall:
+static inline struct trex_channel *channel_arg(struct trex_context *ctx, uint32_t c) {
+    if (c >= ctx->channels_count) {
+        ctx->sm->exec_status = ERROR_SYSC_INVALID_ARG;
+        return 0;
+    }
+    return &ctx->channels[c];
+}
+
+static inline uint16_t channel_used(const struct trex_channel *ch) {
+    return (uint16_t)(ch->tail - ch->head);
+}
+
+void trex_channel_park(struct trex_context *ctx, struct trex_sm *sm) {
+    struct trex_channel *ch = &ctx->channels[sm->channel];
+    sm->waiting = 0;
+
+    // a value sent since the wait was requested needs no wait at all:
+    if (channel_used(ch)) {
+        return;
+    }
+
+    ch->waiter = (uint16_t)(sm - ctx->machines + 1);
+    sm->exec_status = WAITING;
+}
+
+void trex_channel_cancel(struct trex_context *ctx, struct trex_sm *sm) {
+    sm->waiting = 0;
+
+    uint16_t m = (uint16_t)(sm - ctx->machines + 1);
+    for (unsigned c = 0; c < ctx->channels_count; c++) {
+        if (ctx->channels[c].waiter == m) {
+            ctx->channels[c].waiter = 0;
+        }
+    }
+}
+
+void trex_sys_channel_send(struct trex_context *ctx) {
+    uint32_t c, value;
+    trex_pop(ctx, &value);
+    trex_pop(ctx, &c);
+
+    struct trex_channel *ch = channel_arg(ctx, c);
+    if (!ch) {
+        return;
+    }
+    if (channel_used(ch) > ch->mask) {
+        // full; the producer may retry on a later slot:
+        trex_push(ctx, 0);
+        return;
+    }
+    ch->buf[ch->tail++ & ch->mask] = value;
+
+    // signal a consumer blocked on the empty channel:
+    if (ch->waiter) {
+        struct trex_sm *sm = &ctx->machines[ch->waiter - 1];
+        ch->waiter = 0;
+        if (sm->exec_status == WAITING) {
+            sm->exec_status = READY;
+            sm->deadline = ctx->clock + sm->latency;
+        }
+    }
+    trex_push(ctx, 1);
+}
+
+void trex_sys_channel_receive(struct trex_context *ctx) {
+    uint32_t c;
+    trex_pop(ctx, &c);
+
+    struct trex_channel *ch = channel_arg(ctx, c);
+    if (!ch) {
+        return;
+    }
+    if (!channel_used(ch)) {
+        trex_push(ctx, 0);
+        trex_push(ctx, 0);
+        return;
+    }
+    trex_push(ctx, ch->buf[ch->head++ & ch->mask]);
+    trex_push(ctx, 1);
+}
+
+void trex_sys_channel_wait(struct trex_context *ctx) {
+    uint32_t c;
+    trex_pop(ctx, &c);
+
+    struct trex_channel *ch = channel_arg(ctx, c);
+    if (!ch) {
+        return;
+    }
+    // channels have a single consumer:
+    uint16_t m = (uint16_t)(ctx->sm - ctx->machines + 1);
+    if (ch->waiter && ch->waiter != m) {
+        ctx->sm->exec_status = ERROR_SYSC_INVALID_STATE;
+        return;
+    }
+    if (channel_used(ch)) {
+        return;
+    }
+    ctx->sm->waiting = 1;
+    ctx->sm->channel = (uint8_t)c;
+}
+
+#ifdef __cplusplus
+}
+#endif
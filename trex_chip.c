@@ -0,0 +1,208 @@
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#include "trex.h"
+#include "trex_impl.h"
+
+// the selected chip if [chip_addr, chip_addr + n) is within it, else fail the syscall:
+static inline uint8_t *chip_span(struct trex_context *ctx, uint32_t n) {
+    if (ctx->chip_curr >= ctx->chips_count) {
+        ctx->sm->exec_status = ERROR_SYSC_INVALID_ARG;
+        return 0;
+    }
+    const struct trex_chip *c = &ctx->chips[ctx->chip_curr];
+    if (ctx->chip_addr > c->size || n > c->size - ctx->chip_addr) {
+        ctx->sm->exec_status = ERROR_SYSC_INVALID_ARG;
+        return 0;
+    }
+    return c->mem + ctx->chip_addr;
+}
+
+void trex_sys_chip_use(struct trex_context *ctx) {
+    uint32_t chip;
+    trex_pop(ctx, &chip);
+    if (chip >= ctx->chips_count) {
+        ctx->sm->exec_status = ERROR_SYSC_INVALID_ARG;
+        return;
+    }
+    ctx->chip_curr = (uint8_t)chip;
+}
+
+void trex_sys_chip_address_set(struct trex_context *ctx) {
+    trex_pop(ctx, &ctx->chip_addr);
+}
+
+void trex_sys_chip_read_no_advance_byte(struct trex_context *ctx) {
+    uint8_t *m = chip_span(ctx, 1);
+    if (!m) {
+        return;
+    }
+    trex_push(ctx, m[0]);
+}
+
+void trex_sys_chip_read_advance_byte(struct trex_context *ctx) {
+    uint8_t *m = chip_span(ctx, 1);
+    if (!m) {
+        return;
+    }
+    ctx->chip_addr++;
+    trex_push(ctx, m[0]);
+}
+
+void trex_sys_chip_read_dword(struct trex_context *ctx) {
+    uint8_t *m = chip_span(ctx, 4);
+    if (!m) {
+        return;
+    }
+    ctx->chip_addr += 4;
+    trex_push(ctx,
+        (uint32_t)m[0]
+        | ((uint32_t)m[1] << 8)
+        | ((uint32_t)m[2] << 16)
+        | ((uint32_t)m[3] << 24)
+    );
+}
+
+void trex_sys_chip_write_no_advance_byte(struct trex_context *ctx) {
+    uint32_t a;
+    trex_pop(ctx, &a);
+    uint8_t *m = chip_span(ctx, 1);
+    if (!m) {
+        return;
+    }
+    m[0] = (uint8_t)a;
+}
+
+void trex_sys_chip_write_advance_byte(struct trex_context *ctx) {
+    uint32_t a;
+    trex_pop(ctx, &a);
+    uint8_t *m = chip_span(ctx, 1);
+    if (!m) {
+        return;
+    }
+    ctx->chip_addr++;
+    m[0] = (uint8_t)a;
+}
+
+void trex_sys_chip_write_dword(struct trex_context *ctx) {
+    uint32_t a;
+    trex_pop(ctx, &a);
+    uint8_t *m = chip_span(ctx, 4);
+    if (!m) {
+        return;
+    }
+    ctx->chip_addr += 4;
+    m[0] = (uint8_t)a;
+    m[1] = (uint8_t)(a >> 8);
+    m[2] = (uint8_t)(a >> 16);
+    m[3] = (uint8_t)(a >> 24);
+}
+
+// copy count bytes from the selected chip and address to another chip and address, advancing
+// the address; source and destination may overlap:
+void trex_sys_chip_copy(struct trex_context *ctx) {
+    uint32_t count, dest_addr, dest_chip;
+    trex_pop(ctx, &count);
+    trex_pop(ctx, &dest_addr);
+    trex_pop(ctx, &dest_chip);
+
+    uint8_t *src = chip_span(ctx, count);
+    if (!src) {
+        return;
+    }
+    if (dest_chip >= ctx->chips_count) {
+        ctx->sm->exec_status = ERROR_SYSC_INVALID_ARG;
+        return;
+    }
+    const struct trex_chip *d = &ctx->chips[dest_chip];
+    if (dest_addr > d->size || count > d->size - dest_addr) {
+        ctx->sm->exec_status = ERROR_SYSC_INVALID_ARG;
+        return;
+    }
+
+    memmove(d->mem + dest_addr, src, count);
+    ctx->chip_addr += count;
+}
+
+// unchanged gaps shorter than a range entry are cheaper to report as changed:
+#define DIFF_MIN_GAP 4
+
+// compare count bytes at the selected chip and address with the copy kept in locals starting at
+// the given local. each changed range is appended to the message as (offset u16, length u16)
+// relative to the address, and copied into the locals. ranges that do not fit in the message are
+// left for the next call. pushes the number of ranges appended:
+void trex_sys_chip_diff(struct trex_context *ctx) {
+    uint32_t local, count;
+    trex_pop(ctx, &count);
+    trex_pop(ctx, &local);
+
+    struct trex_sm *sm = ctx->sm;
+    if (local > sm->locals_count || count > (sm->locals_count - local) * 4u) {
+        sm->exec_status = ERROR_SYSC_INVALID_ARG;
+        return;
+    }
+    const uint8_t *curr = chip_span(ctx, count);
+    if (!curr) {
+        return;
+    }
+    uint8_t *prev = (uint8_t *)(sm->locals + local);
+
+    uint32_t ranges = 0;
+    uint32_t i = 0;
+    while ((i = trex_mismatch(prev, curr, i, count)) < count) {
+        // extend the range until DIFF_MIN_GAP unchanged bytes in a row:
+        uint32_t start = i;
+        uint32_t end = i + 1;
+        for (i = end; i < count && i - end < DIFF_MIN_GAP; i++) {
+            if (prev[i] != curr[i]) {
+                end = i + 1;
+            }
+        }
+
+        if (ctx->message_size + 4 > TREX_MESSAGE_SIZE) {
+            break;
+        }
+        uint8_t *m = ctx->message + ctx->message_size;
+        ctx->message_size += 4;
+        st16(&m, start);
+        st16(&m, end - start);
+
+        memcpy(prev + start, curr + start, end - start);
+        ranges++;
+        i = end;
+    }
+
+    trex_push(ctx, ranges);
+}
+
+#undef DIFF_MIN_GAP
+
+// read dwords from the selected chip and address into locals starting at the given local,
+// advancing the address:
+void trex_sys_chip_read_locals(struct trex_context *ctx) {
+    uint32_t local, dwords;
+    trex_pop(ctx, &dwords);
+    trex_pop(ctx, &local);
+
+    uint32_t *l = locals_span(ctx, local, dwords);
+    if (!l) {
+        return;
+    }
+    uint8_t *m = chip_span(ctx, dwords * 4);
+    if (!m) {
+        return;
+    }
+    ctx->chip_addr += dwords * 4;
+    for (uint32_t n = 0; n < dwords; n++) {
+        l[n] = ld32(&m);
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -29,193 +29,171 @@ void trex_pop(struct trex_context *ctx, uint32_t *o_val) {
 // that no stack access is out of bounds and no local access is out of bounds and no PC access
 // is out of bounds.
 int trex_sm_exec(struct trex_context *ctx, int cycles) {
-    const struct trex_sh  *sh;
-    struct trex_sm *sm = ctx->sm;
-    if (!sm) {
-        return cycles;
-    }
+#define TREX_INTERP_SYSCALLS ctx->syscalls
+#define TREX_INTERP_CALL(x, s) (s)->call(ctx)
+#include "trex_interp.h"
+#undef TREX_INTERP_CALL
+#undef TREX_INTERP_SYSCALLS
+}
 
-    if (sm->exec_status == HALTED) {
-        return cycles;
-    }
+// advance the scheduler to choose the next state machine, then execute the state machine for at most the specified number of cycles:
+void trex_exec(struct trex_context *ctx) {
+    trex_exec_at(ctx, ctx->now + 1, ctx->cycles_per_exec);
+}
 
-    if (sm->exec_status == READY) {
-        // move to next state:
-        sm->exec_status = EXECUTING;
-        sm->st = sm->nxst;
-        sh = sm->handlers + sm->st;
-
-        // reset registers:
-        ctx->pc = sh->pc_start;
-        ctx->sp = ctx->stack_max;
-        ctx->a = 0;
-    } else {
-        // EXECUTING status:
-        sh = sm->handlers + sm->st;
-    }
+// the handler the machine runs next; a READY machine starts nxst, any other one resumes st:
+static inline const struct trex_sh *next_handler(const struct trex_sm *sm) {
+    return &sm->handlers[sm->exec_status == READY ? sm->nxst : sm->st];
+}
 
-    // don't continue if we're in HALTED or ERRORED status:
-    if (sm->exec_status != EXECUTING) {
-        return cycles;
+// whether the machine's next handler fits in what is left of its session's budget:
+static inline int session_fits(const struct trex_context *ctx, const struct trex_sm *sm) {
+    if (sm->session >= ctx->sessions_count || !ctx->sessions[sm->session].budget) {
+        return 1;
     }
+    const struct trex_session *s = &ctx->sessions[sm->session];
+    return s->used <= s->budget && next_handler(sm)->max_cost <= s->budget - s->used;
+}
 
-    // make sure the state handler has been verified:
-    if (sh->verify_status != VERIFIED) {
-        sm->exec_status = ERROR_UNVERIFIED;
-        return cycles;
+// whether the machine's next handler fits in what is left of its slot's quota and its session's
+// budget. the first handler of a slot always runs so that every slot makes progress:
+static inline int slot_fits(const struct trex_context *ctx, const struct trex_sm *sm) {
+    if (ctx->slot_cycles == 0) {
+        return 1;
+    }
+    if (sm->quota && (ctx->slot_cycles > sm->quota || next_handler(sm)->max_cost > sm->quota - ctx->slot_cycles)) {
+        return 0;
     }
+    return session_fits(ctx, sm);
+}
 
-    uint8_t         *pc = ctx->pc;
-    uint8_t         *pc_end = sh->pc_end;
-    uint32_t        *sp = ctx->sp;
-    uint32_t        a = ctx->a;
+int trex_sm_runnable(const struct trex_context *ctx, const struct trex_sm *sm) {
+    return sm->exec_status != NOT_EXECUTABLE
+        && sm->exec_status < HALTED
+        && sm->handlers_count != 0
+        && session_fits(ctx, sm);
+}
 
-    while (cycles > 0) {
-        if (pc >= pc_end) {
-            sm->exec_status = READY;
-            break;
+// default policy; the next runnable machine at or after curr_machine:
+static struct trex_sm *schedule_round_robin(struct trex_context *ctx) {
+    for (unsigned i = 0; i < ctx->machines_count; ++i, ++ctx->curr_machine) {
+        if (ctx->curr_machine >= ctx->machines_count) {
+            ctx->curr_machine = 0;
         }
+        if (trex_sm_runnable(ctx, &ctx->machines[ctx->curr_machine])) {
+            return &ctx->machines[ctx->curr_machine];
+        }
+    }
+    return 0;
+}
 
-        cycles--;
-        uint8_t i = ld8(&pc);
-
-        // PC and stack ops:
-        if (i == SYS1 || i == SYS2) {
-            const uint16_t x = (i == SYS2) ? ld16(&pc) : ld8(&pc);
-            const struct trex_syscall *s = &ctx->syscalls[x];
-
-            // switch to IN_SYSCALL status so we can verify push/pop calls:
-            sm->exec_status = IN_SYSCALL;
-            ctx->expected_pops = s->args;
-            ctx->expected_push = s->returns;
-
-            ctx->sp = sp;
-            s->call(ctx);
-            sp = ctx->sp;
-
-            // if syscall returned an error, return immediately:
-            if (sm->exec_status != IN_SYSCALL) {
-                break;
-            }
-
-            // verify expected pops and pushes:
-            if (ctx->expected_pops != 0) {
-                sm->exec_status = ERROR_SYSC_MISMATCHED_ARGS;
-                break;
-            }
-            if (ctx->expected_push != 0) {
-                sm->exec_status = ERROR_SYSC_MISMATCHED_RETS;
-                break;
-            }
-
-            // resume normal execution:
-            sm->exec_status = EXECUTING;
+struct trex_sm *trex_schedule_edf(struct trex_context *ctx) {
+    // the round-robin candidate, from where round-robin left off before any deadline picks:
+    struct trex_sm *rr = 0;
+    unsigned m = ctx->schedule_next;
+    for (unsigned i = 0; i < ctx->machines_count; ++i, ++m) {
+        if (m >= ctx->machines_count) {
+            m = 0;
         }
-        else if (i == IMM1) a = ld8(&pc);                       // load immediate u8
-        else if (i == IMM2) a = ld16(&pc);                      // load immediate u16
-        else if (i == IMM3) a = ld24(&pc);                      // load immediate u24
-        else if (i == IMM4) a = ld32(&pc);                      // load immediate u32
-        else if (i == LDL1) a = sm->locals[ld8(&pc)];           // load from local
-        else if (i == LDL2) a = sm->locals[ld16(&pc)];          // load from local
-        else if (i == STL1) sm->locals[ld8(&pc)] = a;           // store to local
-        else if (i == STL2) sm->locals[ld16(&pc)] = a;          // store to local
-        else if (i == SST1) sm->nxst = ld8(&pc);                // set-state
-        else if (i == SST2) sm->nxst = ld16(&pc);               // set-state
-        else if (i == PSH1) *--sp = ld8(&pc);                   // push immediate u8
-        else if (i == PSH2) *--sp = ld16(&pc);                  // push immediate u16
-        else if (i == PSH3) *--sp = ld24(&pc);                  // push immediate u24
-        else if (i == PSH4) *--sp = ld32(&pc);                  // push immediate u32
-        else if (i == BZ)   pc = (a ? pc : pc + *pc) + 1;       // branch forward if A zero
-        else if (i == BNZ)  pc = (a ? pc + *pc : pc) + 1;       // branch forward if A not zero
-        else if (i == PSHA) *--sp = a;                          // push
-        else if (i == POP)  a = *sp++;                          // pop
-
-        // stack ops:
-        else if (i == OR)   a = *sp++ |  a;
-        else if (i == XOR)  a = *sp++ ^  a;
-        else if (i == AND)  a = *sp++ &  a;
-        else if (i == EQ)   a = *sp++ == a;
-        else if (i == NE)   a = *sp++ != a;
-        else if (i == LTU)  a = *sp++ <  a;
-        else if (i == LTS)  a = (int32_t)*sp++ <  (int32_t)a;
-        else if (i == GTU)  a = *sp++ >  a;
-        else if (i == GTS)  a = (int32_t)*sp++ >  (int32_t)a;
-        else if (i == LEU)  a = *sp++ <= a;
-        else if (i == LES)  a = (int32_t)*sp++ <= (int32_t)a;
-        else if (i == GEU)  a = *sp++ >= a;
-        else if (i == GES)  a = (int32_t)*sp++ >= (int32_t)a;
-        else if (i == SHL)  a = *sp++ << a;
-        else if (i == SHRU) a = *sp++ >> a;
-        else if (i == SHRS) a = (int32_t)*sp++ >> a;
-        else if (i == ADD)  a = *sp++ +  a;
-        else if (i == SUB)  a = *sp++ -  a;
-        else if (i == MUL)  a = *sp++ *  a;
-
-        else if (i == RET) {
-            sm->exec_status = READY;
+        if (trex_sm_runnable(ctx, &ctx->machines[m])) {
+            rr = &ctx->machines[m];
             break;
         }
-        else if (i == HALT) {
-            sm->exec_status = HALTED;
-            break;
+    }
+    if (!rr) {
+        return 0;
+    }
+
+    // a deadline that falls within the candidate's slot, at its worst case, cannot wait for it:
+    const uint32_t cost = trex_sm_slot_cost(rr);
+    const int32_t span = cost > INT32_MAX ? INT32_MAX : (int32_t)cost;
+    struct trex_sm *best = 0;
+    int32_t best_slack = 0;
+    for (unsigned i = 0; i < ctx->machines_count; i++) {
+        struct trex_sm *sm = &ctx->machines[i];
+        if (!sm->latency || !trex_sm_runnable(ctx, sm)) {
+            continue;
         }
-        else {
-            // TODO: unknown opcode
-            break;
+        // cycles left until the deadline, wrap-safe:
+        int32_t slack = (int32_t)(sm->deadline - ctx->clock);
+        if (slack <= span && (!best || slack < best_slack)) {
+            best = sm;
+            best_slack = slack;
         }
     }
 
-    ctx->a = a;
-    ctx->pc = pc;
-    ctx->sp = sp;
-
-    return cycles;
+    if (!best || best == rr) {
+        ctx->schedule_next = m + 1;
+        return rr;
+    }
+    return best;
 }
 
-// advance the scheduler to choose the next state machine, then execute the state machine for at most the specified number of cycles:
-void trex_exec(struct trex_context *ctx) {
+// set the host time, then run the scheduler for at most the given number of cycles:
+void trex_exec_at(struct trex_context *ctx, uint32_t now, int cycles) {
     int last_cycles = 0;
-    int cycles = ctx->cycles_per_exec;
+    int chained = 0;
+    ctx->now = now;
+    trex_sleep_wake(ctx);
+    for (unsigned s = 0; s < ctx->sessions_count; s++) {
+        ctx->sessions[s].used = 0;
+    }
     while (cycles > 0 && cycles != last_cycles) {
         // if necessary, find the next machine to execute:
         if (!ctx->sm) {
-            for (int i = 0; i < ctx->machines_count && !ctx->sm; ++i, ++ctx->curr_machine) {
-                if (ctx->curr_machine >= ctx->machines_count) {
-                    ctx->curr_machine = 0;
-                }
-
-                ctx->sm = &ctx->machines[ctx->curr_machine];
-                if (!ctx->sm) {
-                    ctx->sm = 0;
-                    continue;
-                }
-                if (ctx->sm->exec_status >= HALTED) {
-                    ctx->sm = 0;
-                    continue;
-                }
-                if (ctx->sm->handlers_count == 0) {
-                    ctx->sm = 0;
-                    continue;
-                }
-            }
+            ctx->sm = ctx->schedule ? ctx->schedule(ctx) : schedule_round_robin(ctx);
             if (!ctx->sm) {
                 // no machines to run:
                 return;
             }
+            ctx->curr_machine = (unsigned)(ctx->sm - ctx->machines);
 
             // reset the iteration counter:
             ctx->iterations_remaining = ctx->sm->iterations;
+            ctx->slot_cycles = 0;
+#ifdef TREX_TRACE
+            trex_trace(ctx, ctx->clock, TRACE_MACHINE, 0, ctx->sm->name);
+#endif
+        }
+
+        // apply a stop requested while the last handler was in progress:
+        if (ctx->sm->stopping && ctx->sm->exec_status == READY) {
+            ctx->sm->exec_status = STOPPED;
+            ctx->sm->stopping = 0;
+            ctx->sm->sleeping = 0;
+            ctx->sm->waiting = 0;
+        }
+
+        // park a machine whose handler requested a sleep:
+        if (ctx->sm->sleeping && ctx->sm->exec_status == READY) {
+            chained = 0;
+            trex_sleep_park(ctx, ctx->sm);
+        }
+
+        // park a machine whose handler waits on an empty channel:
+        if (ctx->sm->waiting && ctx->sm->exec_status == READY) {
+            chained = 0;
+            trex_channel_park(ctx, ctx->sm);
         }
 
         if (ctx->sm->exec_status == READY) {
             // printf("%d] iterations = %d\n", ctx->curr_machine, ctx->iterations_remaining);
-            if (ctx->iterations_remaining == 0) {
+            // a chained state continues within the same slot, quota permitting:
+            if ((!chained && ctx->iterations_remaining == 0) || !slot_fits(ctx, ctx->sm)) {
                 // pick the next state machine to run:
+                ctx->sm->deadline = ctx->clock + ctx->sm->latency;
                 ctx->sm = 0;
                 ctx->curr_machine++;
+                chained = 0;
                 continue;
             }
-            ctx->iterations_remaining--;
+            if (!chained) {
+                ctx->iterations_remaining--;
+#ifdef TREX_STATS
+                ctx->sm->stats.slots++;
+#endif
+            }
+            chained = 0;
         } else if (ctx->sm->exec_status >= HALTED) {
             // pick the next state machine to run:
             ctx->sm = 0;
@@ -225,7 +203,26 @@ void trex_exec(struct trex_context *ctx) {
 
         // execute the current state machine:
         last_cycles = cycles;
-        cycles = trex_sm_exec(ctx, cycles);
+        cycles = ctx->exec ? ctx->exec(ctx, cycles) : trex_sm_exec(ctx, cycles);
+        ctx->clock += last_cycles - cycles;
+        ctx->slot_cycles += last_cycles - cycles;
+        if (ctx->sm->session < ctx->sessions_count) {
+            ctx->sessions[ctx->sm->session].used += last_cycles - cycles;
+        }
+
+        // a handler that returned from a chained state does not use up an iteration:
+        chained = ctx->sm->exec_status == READY
+            && ctx->sm->st < TREX_CHAIN_STATES
+            && (ctx->sm->chain >> ctx->sm->st & 1)
+            && !ctx->sm->stopping
+            && !ctx->sm->sleeping
+            && !ctx->sm->waiting;
+
+        // a handler that halted or faulted drops the sleep or wait it requested:
+        if (ctx->sm->exec_status >= HALTED) {
+            ctx->sm->sleeping = 0;
+            ctx->sm->waiting = 0;
+        }
     }
 }
 
@@ -245,6 +242,7 @@ void trex_context_init(
 
     ctx->syscalls = syscalls;
     ctx->syscalls_count = syscalls_count;
+    ctx->exec = 0;
 
     ctx->curr_machine = 0;
     ctx->sm = 0;
@@ -253,12 +251,49 @@ void trex_context_init(
     ctx->a = 0;
     ctx->pc = 0;
     ctx->sp = 0;
+    for (int r = 0; r < TREX_REGISTERS; r++) {
+        ctx->r[r] = 0;
+    }
+    ctx->loop_pc = 0;
+    ctx->loop_index = 0;
+    ctx->loop_count = 0;
 
     ctx->expected_pops = 0;
     ctx->expected_push = 0;
 
     ctx->machines = 0;
     ctx->machines_count = 0;
+    ctx->schedule = 0;
+    ctx->schedule_next = 0;
+    ctx->slot_cycles = 0;
+    ctx->sessions_count = 0;
+    ctx->sessions = 0;
+
+    ctx->clock = 0;
+    ctx->now = 0;
+
+    ctx->channels_count = 0;
+    ctx->channels = 0;
+    ctx->consts_count = 0;
+    ctx->consts = 0;
+    ctx->chips_count = 0;
+    ctx->chips = 0;
+    ctx->chip_curr = 0;
+    ctx->chip_addr = 0;
+    ctx->message_size = 0;
+    ctx->message_send = 0;
+    ctx->sleepers = 0;
+    ctx->sleepers_count = 0;
+    ctx->sleepers_cap = 0;
+#ifdef TREX_TRACE
+    ctx->trace = 0;
+    ctx->trace_mask = 0;
+    ctx->trace_head = 0;
+#endif
+
+    ctx->arena = 0;
+    ctx->names = 0;
+    ctx->names_bits = 0;
 }
 
 void trex_sm_init(
@@ -269,11 +304,55 @@ void trex_sm_init(
     uint32_t    *locals
 ) {
     sm->exec_status = NOT_EXECUTABLE;
+    sm->st = 0;
+    sm->nxst = 0;
+    sm->stopping = 0;
+    sm->sleeping = 0;
+    sm->wake_at = 0;
+    sm->waiting = 0;
+    sm->channel = 0;
+    sm->deadline = 0;
+    sm->latency = 0;
+    sm->quota = 0;
+    sm->session = TREX_NO_SESSION;
+    sm->chain = 0;
     sm->iterations = iterations;
     sm->locals = locals;
     sm->locals_count = locals_count;
+    sm->block = 0;
+#ifdef TREX_STATS
+    trex_sm_stats_reset(sm);
+#endif
 }
 
+#ifdef TREX_TRACE
+void trex_trace_init(
+    struct trex_context *ctx,
+    struct trex_trace_event *events,
+    uint32_t events_count
+) {
+    ctx->trace = events;
+    ctx->trace_mask = events_count - 1;
+    ctx->trace_head = 0;
+}
+#endif
+
+#ifdef TREX_STATS
+void trex_sm_stats_snapshot(const struct trex_sm *sm, struct trex_sm_stats *o_stats) {
+    *o_stats = sm->stats;
+}
+
+void trex_sm_stats_reset(struct trex_sm *sm) {
+    sm->stats.instructions = 0;
+    sm->stats.syscalls = 0;
+    sm->stats.completions = 0;
+    sm->stats.slots = 0;
+    sm->stats.preemptions = 0;
+    sm->stats.max_handler_cycles = 0;
+    sm->stats.handler_cycles = 0;
+}
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,30 +1,47 @@
 #pragma once
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 #include <stdint.h>
+#include <string.h>
+
+#include "trex.h"
 
-static inline uint32_t ld8(uint8_t **p) {
+// helpers used by the verifier are constexpr in C++ so that trex_builder.hpp can verify handlers
+// at compile time:
+#ifdef __cplusplus
+#define TREX_CONSTEXPR constexpr
+#else
+#define TREX_CONSTEXPR
+#endif
+
+static inline TREX_CONSTEXPR uint32_t ld8(uint8_t **p) {
     uint32_t a = *(*p)++;
     return a;
 }
 
-static inline uint32_t ld16(uint8_t **p) {
+static inline TREX_CONSTEXPR uint32_t ld16(uint8_t **p) {
     uint32_t a = *(*p)++;
     a |= (uint32_t)(*(*p)++) << 8;
     return a;
 }
 
-static inline uint32_t ld24(uint8_t **p) {
+static inline TREX_CONSTEXPR uint32_t ld24(uint8_t **p) {
     uint32_t a = *(*p)++;
     a |= (uint32_t)(*(*p)++) << 8;
     a |= (uint32_t)(*(*p)++) << 16;
     return a;
 }
 
-static inline uint32_t ld32(uint8_t **p) {
+static inline TREX_CONSTEXPR uint32_t ld32(uint8_t **p) {
     uint32_t a = *(*p)++;
     a |= (uint32_t)(*(*p)++) << 8;
     a |= (uint32_t)(*(*p)++) << 16;
@@ -32,6 +49,124 @@ static inline uint32_t ld32(uint8_t **p) {
     return a;
 }
 
+static inline void st8(uint8_t **p, uint32_t a) {
+    *(*p)++ = (uint8_t)a;
+}
+
+static inline void st16(uint8_t **p, uint32_t a) {
+    *(*p)++ = (uint8_t)a;
+    *(*p)++ = (uint8_t)(a >> 8);
+}
+
+static inline void st32(uint8_t **p, uint32_t a) {
+    *(*p)++ = (uint8_t)a;
+    *(*p)++ = (uint8_t)(a >> 8);
+    *(*p)++ = (uint8_t)(a >> 16);
+    *(*p)++ = (uint8_t)(a >> 24);
+}
+
+// the syscall has a call function. at compile time whether a function's address is null is not
+// always a constant, e.g. with -fno-delete-null-pointer-checks; a call that is not a null
+// constant is then taken to be a function:
+static inline TREX_CONSTEXPR int trex_syscall_mapped(const struct trex_syscall *s) {
+#ifdef __cplusplus
+    if (__builtin_is_constant_evaluated() && !__builtin_constant_p(s->call != 0)) {
+        return 1;
+    }
+#endif
+    return s->call != 0;
+}
+
+// the current machine's locals [local, local + count) if in range, else fail the syscall:
+static inline uint32_t *locals_span(struct trex_context *ctx, uint32_t local, uint32_t count) {
+    struct trex_sm *sm = ctx->sm;
+    if (local > sm->locals_count || count > sm->locals_count - local) {
+        sm->exec_status = ERROR_SYSC_INVALID_ARG;
+        return 0;
+    }
+    return sm->locals + local;
+}
+
+// mask of the low width bits; width is 1..32:
+static inline TREX_CONSTEXPR uint32_t bitmask(uint32_t width) {
+    return 0xFFFFFFFFu >> (32 - width);
+}
+
+static inline uint32_t rotl32(uint32_t x, uint32_t n) {
+    n &= 31;
+    return (x << n) | (x >> ((32 - n) & 31));
+}
+
+static inline TREX_CONSTEXPR uint32_t bswap32(uint32_t x) {
+    return (x >> 24) | ((x >> 8) & 0xFF00u) | ((x << 8) & 0xFF0000u) | (x << 24);
+}
+
+// index of the first byte at or after i where a and b differ, or n if none do. memory being
+// compared is mostly unchanged, so long equal stretches are skipped 16 bytes at a time with SSE2
+// or NEON, or a word at a time elsewhere (e.g. Cortex-M3):
+static inline uint32_t trex_mismatch(const uint8_t *a, const uint8_t *b, uint32_t i, uint32_t n) {
+#if defined(__SSE2__)
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+        unsigned ne = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xFFFF;
+        if (ne) {
+            return i + (uint32_t)__builtin_ctz(ne);
+        }
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t eq = vceqq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+        if (vminvq_u8(eq) != 0xFF) {
+            break;
+        }
+    }
+#else
+    for (; i + 4 <= n; i += 4) {
+        uint32_t x, y;
+        memcpy(&x, a + i, 4);
+        memcpy(&y, b + i, 4);
+        if (x != y) {
+            break;
+        }
+    }
+#endif
+    while (i < n && a[i] == b[i]) {
+        i++;
+    }
+    return i;
+}
+
+// sleeper heap maintenance, in trex_sleep.c. park applies a sleep requested by the handler that
+// just returned; wake readies every machine whose wake time has been reached by ctx->now:
+void trex_sleep_park(struct trex_context *ctx, struct trex_sm *sm);
+void trex_sleep_wake(struct trex_context *ctx);
+// drop a machine's pending or parked sleep:
+void trex_sleep_cancel(struct trex_context *ctx, struct trex_sm *sm);
+// rebuild the heap from SLEEPING machines; returns 0 if they do not fit:
+int trex_sleep_rebuild(struct trex_context *ctx);
+
+// channel waits, in trex_channel.c. park applies a wait requested by the handler that just
+// returned; cancel drops a machine's pending or parked wait:
+void trex_channel_park(struct trex_context *ctx, struct trex_sm *sm);
+void trex_channel_cancel(struct trex_context *ctx, struct trex_sm *sm);
+
+#ifdef TREX_TRACE
+// record a trace event into the context's trace ring:
+static inline void trex_trace(struct trex_context *ctx, uint32_t time, uint8_t kind, uint8_t arg, uint32_t data) {
+    if (!ctx->trace) {
+        return;
+    }
+
+    struct trex_trace_event *e = &ctx->trace[ctx->trace_head++ & ctx->trace_mask];
+    e->time = time;
+    e->machine = (uint16_t)ctx->curr_machine;
+    e->kind = kind;
+    e->arg = arg;
+    e->data = data;
+}
+#endif
+
 #ifdef __cplusplus
 }
 #endif
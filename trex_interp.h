@@ -0,0 +1,281 @@
+// body of the bytecode interpreter, shared by trex_sm_exec() in trex_exec.c and the specialized
+// interpreters of trex.hpp so that they cannot diverge. it is included inside a function
+// `int f(struct trex_context *ctx, int cycles)` with these defined:
+//   TREX_INTERP_SYSCALLS   the syscall table to index, e.g. ctx->syscalls
+//   TREX_INTERP_CALL(x, s) call syscall number x whose descriptor is s
+// it needs trex.h, trex_opcodes.h and trex_impl.h, and has no include guard on purpose.
+
+    const struct trex_sh  *sh;
+    struct trex_sm *sm = ctx->sm;
+    if (!sm) {
+        return cycles;
+    }
+
+    if (sm->exec_status == HALTED) {
+        return cycles;
+    }
+
+    if (sm->exec_status == READY) {
+        // move to next state:
+        sm->exec_status = EXECUTING;
+#ifdef TREX_TRACE
+        trex_trace(ctx, ctx->clock, TRACE_STATE, 0, ((uint32_t)sm->st << 16) | sm->nxst);
+#endif
+        sm->st = sm->nxst;
+        sh = sm->handlers + sm->st;
+
+        // reset registers:
+        ctx->pc = sh->pc_start;
+        ctx->sp = ctx->stack_max;
+        ctx->a = 0;
+    } else {
+        // EXECUTING status:
+        sh = sm->handlers + sm->st;
+    }
+
+    // don't continue if we're in HALTED or ERRORED status:
+    if (sm->exec_status != EXECUTING) {
+        return cycles;
+    }
+
+    // make sure the state handler has been verified:
+    if (sh->verify_status != VERIFIED) {
+        sm->exec_status = ERROR_UNVERIFIED;
+#ifdef TREX_TRACE
+        trex_trace(ctx, ctx->clock, TRACE_ERROR, 0, sm->exec_status);
+#endif
+        return cycles;
+    }
+
+    uint8_t         *pc = ctx->pc;
+    uint8_t         *pc_end = sh->pc_end;
+    uint32_t        *sp = ctx->sp;
+    uint32_t        a = ctx->a;
+#if defined(TREX_STATS) || defined(TREX_TRACE)
+    const int       cycles_start = cycles;
+#endif
+
+    while (cycles > 0) {
+        if (pc >= pc_end) {
+            sm->exec_status = READY;
+            break;
+        }
+
+        cycles--;
+        uint8_t i = ld8(&pc);
+
+        // PC and stack ops:
+        if (i == SYS1 || i == SYS2) {
+            const uint16_t x = (i == SYS2) ? ld16(&pc) : ld8(&pc);
+            const struct trex_syscall *s = &TREX_INTERP_SYSCALLS[x];
+
+#ifdef TREX_STATS
+            sm->stats.syscalls++;
+#endif
+
+            // switch to IN_SYSCALL status so we can verify push/pop calls:
+            sm->exec_status = IN_SYSCALL;
+            ctx->expected_pops = s->args;
+            ctx->expected_push = s->returns;
+
+#ifdef TREX_TRACE
+            trex_trace(ctx, ctx->clock + (cycles_start - cycles), TRACE_SYSCALL_ENTER, s->args, x);
+#endif
+            ctx->sp = sp;
+            TREX_INTERP_CALL(x, s);
+            sp = ctx->sp;
+#ifdef TREX_TRACE
+            trex_trace(ctx, ctx->clock + (cycles_start - cycles), TRACE_SYSCALL_EXIT, s->returns, x);
+#endif
+
+            // if syscall returned an error, return immediately:
+            if (sm->exec_status != IN_SYSCALL) {
+                break;
+            }
+
+            // verify expected pops and pushes:
+            if (ctx->expected_pops != 0) {
+                sm->exec_status = ERROR_SYSC_MISMATCHED_ARGS;
+                break;
+            }
+            if (ctx->expected_push != 0) {
+                sm->exec_status = ERROR_SYSC_MISMATCHED_RETS;
+                break;
+            }
+
+            // charge the syscall's declared cost; may overdraw the remaining cycles:
+            cycles -= s->cost;
+
+            // resume normal execution:
+            sm->exec_status = EXECUTING;
+        }
+        else if (i == IMM1) a = ld8(&pc);                       // load immediate u8
+        else if (i == IMM2) a = ld16(&pc);                      // load immediate u16
+        else if (i == IMM3) a = ld24(&pc);                      // load immediate u24
+        else if (i == IMM4) a = ld32(&pc);                      // load immediate u32
+        else if (i == LDL1) a = sm->locals[ld8(&pc)];           // load from local
+        else if (i == LDL2) a = sm->locals[ld16(&pc)];          // load from local
+        else if (i == STL1) sm->locals[ld8(&pc)] = a;           // store to local
+        else if (i == STL2) sm->locals[ld16(&pc)] = a;          // store to local
+        else if (i == LDLX || i == STLX) {                      // load/store local base + A
+            const uint32_t x = ld8(&pc) + a;
+            // A is unknown to the verifier, so the index is checked here:
+            if (x >= sm->locals_count) {
+                sm->exec_status = ERROR_LOCAL_OUT_OF_RANGE;
+                break;
+            }
+            if (i == LDLX) a = sm->locals[x];
+            else           sm->locals[x] = *sp++;
+        }
+        else if (i == LDC1) a = ctx->consts[ld8(&pc)];          // load constant
+        else if (i == LDC2) a = ctx->consts[ld16(&pc)];         // load constant
+        else if (i == LDCX) {                                   // load constant base + A
+            const uint32_t x = ld8(&pc) + a;
+            if (x >= ctx->consts_count) {
+                sm->exec_status = ERROR_CONSTANT_OUT_OF_RANGE;
+                break;
+            }
+            a = ctx->consts[x];
+        }
+        else if (i == SST1) sm->nxst = ld8(&pc);                // set-state
+        else if (i == SST2) sm->nxst = ld16(&pc);               // set-state
+        else if (i == PSH1) *--sp = ld8(&pc);                   // push immediate u8
+        else if (i == PSH2) *--sp = ld16(&pc);                  // push immediate u16
+        else if (i == PSH3) *--sp = ld24(&pc);                  // push immediate u24
+        else if (i == PSH4) *--sp = ld32(&pc);                  // push immediate u32
+        else if (i == BZ)   pc = (a ? pc : pc + *pc) + 1;       // branch forward if A zero
+        else if (i == BNZ)  pc = (a ? pc + *pc : pc) + 1;       // branch forward if A not zero
+        else if (i == LPS) {                                    // loop start
+            const uint32_t cap = ld8(&pc);
+            const uint32_t skip = ld8(&pc);
+            if (a == 0) {
+                pc += skip;
+            } else {
+                ctx->loop_pc = pc;
+                ctx->loop_index = 0;
+                ctx->loop_count = a < cap ? a : cap;
+            }
+        }
+        else if (i == LPE) {                                    // loop end
+            if (++ctx->loop_index < ctx->loop_count) {
+                pc = ctx->loop_pc;
+            }
+        }
+        else if (i == LPI)  a = ctx->loop_index;                // load loop index
+        else if (i == PSHA) *--sp = a;                          // push
+        else if (i == POP)  a = *sp++;                          // pop
+
+        // stack ops:
+        else if (i == OR)   a = *sp++ |  a;
+        else if (i == XOR)  a = *sp++ ^  a;
+        else if (i == AND)  a = *sp++ &  a;
+        else if (i == EQ)   a = *sp++ == a;
+        else if (i == NE)   a = *sp++ != a;
+        else if (i == LTU)  a = *sp++ <  a;
+        else if (i == LTS)  a = (int32_t)*sp++ <  (int32_t)a;
+        else if (i == GTU)  a = *sp++ >  a;
+        else if (i == GTS)  a = (int32_t)*sp++ >  (int32_t)a;
+        else if (i == LEU)  a = *sp++ <= a;
+        else if (i == LES)  a = (int32_t)*sp++ <= (int32_t)a;
+        else if (i == GEU)  a = *sp++ >= a;
+        else if (i == GES)  a = (int32_t)*sp++ >= (int32_t)a;
+        else if (i == SHL)  a = *sp++ << a;
+        else if (i == SHRU) a = *sp++ >> a;
+        else if (i == SHRS) a = (int32_t)*sp++ >> a;
+        else if (i == ADD)  a = *sp++ +  a;
+        else if (i == SUB)  a = *sp++ -  a;
+        else if (i == MUL)  a = *sp++ *  a;
+        else if (i == ROL)  a = rotl32(*sp++, a);
+        else if (i == ROR)  a = rotl32(*sp++, 0u - a);
+        else if (i == PACK16) a = (*sp++ << 16) | (a & 0xFFFFu);                 // pack two 16-bit lanes
+        else if (i == ADD16) { const uint32_t b = *sp++; a = ((b & 0xFFFF0000u) + (a & 0xFFFF0000u)) | ((b + a) & 0xFFFFu); }
+        else if (i == SUB16) { const uint32_t b = *sp++; a = ((b & 0xFFFF0000u) - (a & 0xFFFF0000u)) | ((b - a) & 0xFFFFu); }
+        else if (i == DIVU || i == DIVS || i == MODU || i == MODS) {
+            const uint32_t b = *sp++;
+            if (a == 0) {
+                sm->exec_status = ERROR_DIVIDE_BY_ZERO;
+                break;
+            }
+            if (i == DIVU)      a = b / a;
+            else if (i == MODU) a = b % a;
+            // signed division by -1 is negation, which also keeps INT32_MIN / -1 defined:
+            else if (a == 0xFFFFFFFFu) a = (i == DIVS) ? 0u - b : 0;
+            else if (i == DIVS) a = (uint32_t)((int32_t)b / (int32_t)a);
+            else                a = (uint32_t)((int32_t)b % (int32_t)a);
+        }
+
+        // register ops:
+        else if (i == LDAR) a = ctx->r[ld8(&pc)];               // load A from register
+        else if (i == STAR) ctx->r[ld8(&pc)] = a;               // store A to register
+        else if (i == IMMR) { const uint32_t d = ld8(&pc); ctx->r[d] = ld8(&pc); }           // load register with immediate u8
+        else if (i == LDLR) { const uint32_t d = ld8(&pc); ctx->r[d] = sm->locals[ld8(&pc)]; } // load register from local
+        else if (i == STLR) { const uint32_t s = ld8(&pc); sm->locals[ld8(&pc)] = ctx->r[s]; } // store register to local
+        else if (i >= MOVR && i <= SHRR) {                      // rd = rd op rs
+            const uint32_t x = ld8(&pc);
+            uint32_t *d = &ctx->r[x >> 4];
+            const uint32_t s = ctx->r[x & 15];
+            if (i == MOVR)      *d = s;
+            else if (i == ADDR) *d += s;
+            else if (i == SUBR) *d -= s;
+            else if (i == MULR) *d *= s;
+            else if (i == ANDR) *d &= s;
+            else if (i == ORR)  *d |= s;
+            else if (i == XORR) *d ^= s;
+            else if (i == SHLR) *d <<= s & 31;
+            else                *d >>= s & 31;
+        }
+
+        // accumulator ops:
+        else if (i == BSWAP) a = bswap32(a);                    // byte-swap
+        else if (i == BEXT) {                                   // extract bitfield
+            const uint32_t pos = ld8(&pc);
+            a = (a >> pos) & bitmask(ld8(&pc));
+        }
+        else if (i == BINS) {                                   // insert bitfield into popped value
+            const uint32_t pos = ld8(&pc);
+            const uint32_t m = bitmask(ld8(&pc)) << pos;
+            a = (*sp++ & ~m) | ((a << pos) & m);
+        }
+
+        else if (i == RET) {
+            sm->exec_status = READY;
+            break;
+        }
+        else if (i == HALT) {
+            sm->exec_status = HALTED;
+            break;
+        }
+        else {
+            // TODO: unknown opcode
+            break;
+        }
+    }
+
+    ctx->a = a;
+    ctx->pc = pc;
+    ctx->sp = sp;
+
+#ifdef TREX_TRACE
+    if (sm->exec_status >= ERROR_UNVERIFIED) {
+        trex_trace(ctx, ctx->clock + (cycles_start - cycles), TRACE_ERROR, 0, sm->exec_status);
+    }
+#endif
+
+#ifdef TREX_STATS
+    sm->stats.instructions += cycles_start - cycles;
+    sm->stats.handler_cycles += cycles_start - cycles;
+    if (sm->exec_status == EXECUTING) {
+        // ran out of cycles in the middle of the handler:
+        sm->stats.preemptions++;
+    } else {
+        if (sm->exec_status == READY || sm->exec_status == HALTED) {
+            sm->stats.completions++;
+        }
+        if (sm->stats.handler_cycles > sm->stats.max_handler_cycles) {
+            sm->stats.max_handler_cycles = sm->stats.handler_cycles;
+        }
+        sm->stats.handler_cycles = 0;
+    }
+#endif
+
+    return cycles;
@@ -0,0 +1,413 @@
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#include "trex.h"
+#include "trex_impl.h"
+
+// fibonacci hash of a name into the index:
+static inline unsigned name_hash(const struct trex_context *ctx, uint32_t name) {
+    return (uint32_t)(name * 2654435769u) >> (32 - ctx->names_bits);
+}
+
+// find the index slot that holds the name, or the empty slot where it would be inserted.
+// the index is kept at most half full so probing always terminates:
+static unsigned name_slot(const struct trex_context *ctx, uint32_t name) {
+    const unsigned mask = (1u << ctx->names_bits) - 1u;
+    unsigned i = name_hash(ctx, name);
+    while (ctx->names[i] && ctx->machines[ctx->names[i] - 1].name != name) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+// remove an index entry by shifting back the entries of its probe chain:
+static void name_remove(struct trex_context *ctx, unsigned i) {
+    const unsigned mask = (1u << ctx->names_bits) - 1u;
+
+    ctx->names[i] = 0;
+    for (unsigned j = (i + 1) & mask; ctx->names[j]; j = (j + 1) & mask) {
+        unsigned k = name_hash(ctx, ctx->machines[ctx->names[j] - 1].name);
+
+        // leave the entry alone if its home slot k lies cyclically within (i, j]:
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) {
+            continue;
+        }
+
+        ctx->names[i] = ctx->names[j];
+        ctx->names[j] = 0;
+        i = j;
+    }
+}
+
+enum trex_result trex_machines_alloc(struct trex_context *ctx, unsigned capacity) {
+    if (!ctx->arena || capacity == 0 || capacity > 0x8000) {
+        return RESULT_OUT_OF_MEMORY;
+    }
+
+    // size the index to at least twice the capacity:
+    uint8_t bits = 1;
+    while ((1u << bits) < capacity * 2) {
+        bits++;
+    }
+
+    struct trex_sm *machines = trex_arena_alloc_fixed(ctx->arena, capacity * sizeof(struct trex_sm));
+    if (!machines) {
+        return RESULT_OUT_OF_MEMORY;
+    }
+    uint16_t *names = trex_arena_alloc_fixed(ctx->arena, (1u << bits) * sizeof(uint16_t));
+    if (!names) {
+        return RESULT_OUT_OF_MEMORY;
+    }
+    struct trex_sleeper *sleepers = trex_arena_alloc_fixed(ctx->arena, capacity * sizeof(struct trex_sleeper));
+    if (!sleepers) {
+        return RESULT_OUT_OF_MEMORY;
+    }
+
+    memset(machines, 0, capacity * sizeof(struct trex_sm));
+    memset(names, 0, (1u << bits) * sizeof(uint16_t));
+
+    ctx->machines = machines;
+    ctx->machines_count = capacity;
+    ctx->names = names;
+    ctx->names_bits = bits;
+    trex_sleepers_init(ctx, sleepers, (uint16_t)capacity);
+    ctx->curr_machine = 0;
+    ctx->sm = 0;
+
+    return RESULT_OK;
+}
+
+struct trex_sm *trex_sm_find(const struct trex_context *ctx, uint32_t name) {
+    if (!ctx->names) {
+        return 0;
+    }
+
+    uint16_t e = ctx->names[name_slot(ctx, name)];
+    return e ? &ctx->machines[e - 1] : 0;
+}
+
+// index of a free machine, or machines_count if none; free machines have no arena block:
+static unsigned free_machine(const struct trex_context *ctx) {
+    unsigned n;
+    for (n = 0; n < ctx->machines_count; n++) {
+        if (!ctx->machines[n].block) {
+            break;
+        }
+    }
+    return n;
+}
+
+enum trex_result trex_sm_create(
+    struct trex_context *ctx,
+    uint32_t     name,
+    uint8_t      iterations,
+    uint8_t      locals_count,
+    uint16_t     handlers_count,
+    uint32_t     code_size
+) {
+    if (!ctx->names) {
+        return RESULT_TOO_MANY_MACHINES;
+    }
+
+    unsigned slot = name_slot(ctx, name);
+    if (ctx->names[slot]) {
+        return RESULT_NAME_EXISTS;
+    }
+
+    unsigned n = free_machine(ctx);
+    if (n >= ctx->machines_count) {
+        return RESULT_TOO_MANY_MACHINES;
+    }
+
+    struct trex_sm *sm = &ctx->machines[n];
+    trex_sm_init(ctx, sm, iterations, 0, 0);
+
+    enum trex_result r = trex_sm_alloc(ctx, sm, locals_count, handlers_count, code_size);
+    if (r != RESULT_OK) {
+        return r;
+    }
+
+    sm->name = name;
+    sm->st = 0;
+    sm->nxst = 0;
+    sm->exec_status = STOPPED;
+    ctx->names[slot] = (uint16_t)(n + 1);
+
+    return RESULT_OK;
+}
+
+enum trex_result trex_sm_instance(
+    struct trex_context *ctx,
+    uint32_t     template_name,
+    uint32_t     name,
+    uint8_t      iterations
+) {
+    struct trex_sm *tmpl = trex_sm_find(ctx, template_name);
+    if (!tmpl) {
+        return RESULT_NAME_NOT_FOUND;
+    }
+
+    unsigned slot = name_slot(ctx, name);
+    if (ctx->names[slot]) {
+        return RESULT_NAME_EXISTS;
+    }
+
+    unsigned n = free_machine(ctx);
+    if (n >= ctx->machines_count) {
+        return RESULT_TOO_MANY_MACHINES;
+    }
+
+    struct trex_sm *sm = &ctx->machines[n];
+    trex_sm_init(ctx, sm, iterations, 0, 0);
+
+    enum trex_result r = trex_sm_alloc_instance(ctx, sm, tmpl);
+    if (r != RESULT_OK) {
+        return r;
+    }
+
+    sm->name = name;
+    sm->exec_status = STOPPED;
+    ctx->names[slot] = (uint16_t)(n + 1);
+
+    return RESULT_OK;
+}
+
+// whether a machine's states may be redefined; shared handlers may not be:
+static enum trex_result states_editable(const struct trex_sm *sm) {
+    if (sm->tmpl) {
+        return RESULT_INVALID_STATE;
+    }
+    if (sm->refs > 1) {
+        return RESULT_RUNNING;
+    }
+    return RESULT_OK;
+}
+
+enum trex_result trex_sm_define_state(
+    struct trex_context *ctx,
+    uint32_t       name,
+    uint16_t       state,
+    const uint8_t *code,
+    uint32_t       code_size
+) {
+    struct trex_sm *sm = trex_sm_find(ctx, name);
+    if (!sm) {
+        return RESULT_NAME_NOT_FOUND;
+    }
+    if (state >= sm->handlers_count) {
+        return RESULT_INVALID_STATE;
+    }
+    if (sm->exec_status != STOPPED && sm->exec_status != NOT_EXECUTABLE) {
+        return RESULT_RUNNING;
+    }
+    enum trex_result r = states_editable(sm);
+    if (r != RESULT_OK) {
+        return r;
+    }
+
+    struct trex_sh *sh = &sm->handlers[state];
+
+    // reuse the state's old range if the new code fits, else append after the last byte used by
+    // any other handler. a state that grows leaves its old range unused until the machine is
+    // deleted:
+    uint8_t *pc = sh->pc_start;
+    if (code_size > (uint32_t)(sh->pc_end - sh->pc_start)) {
+        uint8_t *end = (uint8_t *)sm->block + sm->block->size;
+        pc = trex_sm_code(sm);
+        for (unsigned i = 0; i < sm->handlers_count; i++) {
+            if (i != state && sm->handlers[i].pc_end > pc) {
+                pc = sm->handlers[i].pc_end;
+            }
+        }
+        if (code_size > (uint32_t)(end - pc)) {
+            return RESULT_OUT_OF_MEMORY;
+        }
+    }
+
+    memcpy(pc, code, code_size);
+
+    sh->verify_status = UNVERIFIED;
+    sh->pc_start = pc;
+    sh->pc_end = pc + code_size;
+
+    return RESULT_OK;
+}
+
+enum trex_result trex_sm_chain_state(
+    struct trex_context *ctx,
+    uint32_t       name,
+    uint16_t       state,
+    uint8_t        chain
+) {
+    struct trex_sm *sm = trex_sm_find(ctx, name);
+    if (!sm) {
+        return RESULT_NAME_NOT_FOUND;
+    }
+    if (state >= sm->handlers_count || state >= TREX_CHAIN_STATES) {
+        return RESULT_INVALID_STATE;
+    }
+    enum trex_result r = states_editable(sm);
+    if (r != RESULT_OK) {
+        return r;
+    }
+
+    if (chain) {
+        sm->chain |= (uint32_t)1 << state;
+    } else {
+        sm->chain &= ~((uint32_t)1 << state);
+    }
+
+    return RESULT_OK;
+}
+
+enum trex_result trex_sm_set_latency(struct trex_context *ctx, uint32_t name, uint32_t latency) {
+    struct trex_sm *sm = trex_sm_find(ctx, name);
+    if (!sm) {
+        return RESULT_NAME_NOT_FOUND;
+    }
+
+    sm->latency = latency;
+
+    return RESULT_OK;
+}
+
+enum trex_result trex_sm_set_quota(struct trex_context *ctx, uint32_t name, uint8_t session, uint32_t quota) {
+    struct trex_sm *sm = trex_sm_find(ctx, name);
+    if (!sm) {
+        return RESULT_NAME_NOT_FOUND;
+    }
+    if (sm->exec_status != STOPPED && sm->exec_status != NOT_EXECUTABLE) {
+        return RESULT_RUNNING;
+    }
+
+    sm->session = session;
+    sm->quota = quota;
+
+    return RESULT_OK;
+}
+
+uint32_t trex_sm_slot_cost(const struct trex_sm *sm) {
+    uint32_t max_cost = 0;
+    for (unsigned i = 0; i < sm->handlers_count; i++) {
+        if (sm->handlers[i].max_cost > max_cost) {
+            max_cost = sm->handlers[i].max_cost;
+        }
+    }
+
+    // chained states may run any number of handlers per slot, so only a quota bounds them:
+    uint64_t cost = sm->chain ? UINT32_MAX : (uint64_t)max_cost * (sm->iterations ? sm->iterations : 1);
+    if (sm->quota && cost > sm->quota) {
+        cost = sm->quota;
+    }
+    return cost > UINT32_MAX ? UINT32_MAX : (uint32_t)cost;
+}
+
+// whether the machine's worst-case slots fit in its quota and its session's budget:
+static int admit(const struct trex_context *ctx, const struct trex_sm *sm) {
+    if (sm->quota) {
+        for (unsigned i = 0; i < sm->handlers_count; i++) {
+            if (sm->handlers[i].max_cost > sm->quota) {
+                return 0;
+            }
+        }
+    }
+
+    if (sm->session >= ctx->sessions_count || !ctx->sessions[sm->session].budget) {
+        return 1;
+    }
+    uint64_t total = trex_sm_slot_cost(sm);
+    for (unsigned i = 0; i < ctx->machines_count; i++) {
+        const struct trex_sm *m = &ctx->machines[i];
+        if (m == sm || m->session != sm->session) {
+            continue;
+        }
+        if (m->exec_status == READY || m->exec_status == EXECUTING || m->exec_status == IN_SYSCALL
+         || m->exec_status == SLEEPING || m->exec_status == WAITING) {
+            total += trex_sm_slot_cost(m);
+        }
+    }
+    return total <= ctx->sessions[sm->session].budget;
+}
+
+enum trex_result trex_sm_run(struct trex_context *ctx, uint32_t name) {
+    struct trex_sm *sm = trex_sm_find(ctx, name);
+    if (!sm) {
+        return RESULT_NAME_NOT_FOUND;
+    }
+
+    // cancel a stop that has not yet been applied:
+    if (sm->stopping) {
+        sm->stopping = 0;
+        return RESULT_OK;
+    }
+    if (sm->exec_status == READY || sm->exec_status == EXECUTING || sm->exec_status == IN_SYSCALL
+     || sm->exec_status == SLEEPING || sm->exec_status == WAITING) {
+        return RESULT_OK;
+    }
+
+    // a restart does not carry over a sleep or wait requested before the machine stopped:
+    sm->sleeping = 0;
+    sm->waiting = 0;
+
+    // already verified handlers are not verified again:
+    trex_sm_verify(ctx, sm, sm->handlers_count, sm->handlers);
+    if (sm->exec_status != READY) {
+        return RESULT_UNVERIFIED;
+    }
+    if (!admit(ctx, sm)) {
+        sm->exec_status = STOPPED;
+        return RESULT_OVER_BUDGET;
+    }
+    sm->deadline = ctx->clock + sm->latency;
+
+    return RESULT_OK;
+}
+
+enum trex_result trex_sm_stop(struct trex_context *ctx, uint32_t name) {
+    struct trex_sm *sm = trex_sm_find(ctx, name);
+    if (!sm) {
+        return RESULT_NAME_NOT_FOUND;
+    }
+
+    if (sm->exec_status == EXECUTING || sm->exec_status == IN_SYSCALL) {
+        // let the handler run to completion:
+        sm->stopping = 1;
+    } else {
+        trex_sleep_cancel(ctx, sm);
+        trex_channel_cancel(ctx, sm);
+        sm->exec_status = STOPPED;
+    }
+
+    return RESULT_OK;
+}
+
+enum trex_result trex_sm_delete(struct trex_context *ctx, uint32_t name) {
+    if (!ctx->names) {
+        return RESULT_NAME_NOT_FOUND;
+    }
+
+    unsigned slot = name_slot(ctx, name);
+    if (!ctx->names[slot]) {
+        return RESULT_NAME_NOT_FOUND;
+    }
+
+    struct trex_sm *sm = &ctx->machines[ctx->names[slot] - 1];
+    name_remove(ctx, slot);
+
+    trex_sleep_cancel(ctx, sm);
+    trex_channel_cancel(ctx, sm);
+    trex_sm_free(ctx, sm);
+    sm->stopping = 0;
+    sm->name = 0;
+
+    return RESULT_OK;
+}
+
+#ifdef __cplusplus
+}
+#endif
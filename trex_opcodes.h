@@ -21,6 +21,23 @@ enum {
     EQ,    NE,    LTU,   LTS,   GTU,   GTS,   LEU,   LES,   GEU,   GES,
     SHL,   SHRU,  SHRS,
     ADD,   SUB,   MUL,
+    DIVU,  DIVS,  MODU,  MODS,
+    ROL,   ROR,
+    BEXT,  BINS,
+    BSWAP,
+    PACK16, ADD16, SUB16,
+    LDLX,  STLX,
+
+    // register ops; operand byte is a register, or dst << 4 | src for two-operand ops:
+    LDAR,  STAR,  IMMR,  LDLR,  STLR,
+    MOVR,  ADDR,  SUBR,  MULR,  ANDR,  ORR,   XORR,  SHLR,  SHRR,
+
+    // counted loop; LPS cap, skip runs the body up to LPE min(A, cap) times and LPI loads the
+    // iteration index into A:
+    LPS,   LPE,   LPI,
+
+    // load from the context's read-only constant pool; LDCX loads constant base + A:
+    LDC1,  LDC2,  LDCX,
     __OPCODE_COUNT
 };
 
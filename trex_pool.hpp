@@ -0,0 +1,103 @@
+#pragma once
+
+// host-side runtime that executes many independent trex contexts in parallel, e.g. one per
+// emulated console in an emulator farm.
+//
+// a context is only ever executed by one worker at a time, so each context keeps using its own
+// stack, machines and locals. syscall tables may be shared read-only between contexts; any state
+// a syscall touches must be reached through its context (e.g. ctx->hostdata).
+
+#include <atomic>
+#include <barrier>
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include "trex.h"
+}
+
+class trex_pool {
+public:
+    // start a pool with the given number of workers; the thread calling exec_frame() is worker 0:
+    explicit trex_pool(unsigned workers)
+        : shards(workers ? workers : 1)
+        , start(shards.size())
+        , done(shards.size())
+    {
+        for (unsigned w = 1; w < shards.size(); w++) {
+            threads.emplace_back([this, w] {
+                for (;;) {
+                    start.arrive_and_wait();
+                    if (stopping) {
+                        return;
+                    }
+                    work(w);
+                    done.arrive_and_wait();
+                }
+            });
+        }
+    }
+
+    ~trex_pool() {
+        stopping = true;
+        start.arrive_and_wait();
+        for (auto &t : threads) {
+            t.join();
+        }
+    }
+
+    trex_pool(const trex_pool &) = delete;
+    trex_pool &operator=(const trex_pool &) = delete;
+
+    unsigned workers() const { return (unsigned)shards.size(); }
+
+    // call trex_exec() once on every context and return when all contexts are done:
+    void exec_frame(std::span<struct trex_context *const> contexts) {
+        // give each worker a contiguous shard so a context tends to stay on the same core
+        // from frame to frame:
+        const size_t n = contexts.size();
+        const size_t w = shards.size();
+        for (size_t i = 0; i < w; i++) {
+            shards[i].next.store(n * i / w, std::memory_order_relaxed);
+            shards[i].end = n * (i + 1) / w;
+        }
+        frame = contexts;
+
+        start.arrive_and_wait();
+        work(0);
+        done.arrive_and_wait();
+    }
+
+private:
+    // a worker's share of the contexts of a frame; other workers steal from it by advancing
+    // the same cursor once the owner falls behind:
+    struct alignas(64) shard {
+        std::atomic<size_t> next{0};
+        size_t              end = 0;
+    };
+
+    void work(unsigned w) {
+        const size_t count = shards.size();
+        for (size_t k = 0; k < count; k++) {
+            // own shard first, then steal from the others in turn:
+            shard &s = shards[(w + k) % count];
+            for (;;) {
+                size_t i = s.next.fetch_add(1, std::memory_order_relaxed);
+                if (i >= s.end) {
+                    break;
+                }
+                trex_exec(frame[i]);
+            }
+        }
+    }
+
+    std::vector<shard> shards;
+    std::vector<std::thread> threads;
+    std::barrier<> start;
+    std::barrier<> done;
+    std::span<struct trex_context *const> frame;
+    std::atomic<bool> stopping{false};
+};
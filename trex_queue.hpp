@@ -0,0 +1,225 @@
+#pragma once
+
+// lock-free queues for talking to a trex context that is executed on another thread.
+//
+// the context itself stays single-threaded: network or UI threads submit commands into a
+// bounded MPSC queue, and the thread that calls trex_exec() applies them with drain() at a
+// safe point between trex_exec() calls. replies and messages flow back through SPSC queues
+// read by a single host I/O thread. no side ever takes a lock or waits on the other.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+extern "C" {
+#include "trex.h"
+}
+
+// bounded single-producer single-consumer ring; N must be a power of two:
+template <typename T, size_t N>
+class trex_spsc {
+    static_assert((N & (N - 1)) == 0, "N must be a power of two");
+
+public:
+    // producer side; returns false if full:
+    bool push(const T &v) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == N) {
+            return false;
+        }
+        items[t & (N - 1)] = v;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // producer side:
+    bool full() const {
+        return tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire) == N;
+    }
+
+    // consumer side; returns false if empty:
+    bool pop(T &o_v) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        o_v = items[h & (N - 1)];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+    T items[N];
+};
+
+// bounded multi-producer single-consumer queue; N must be a power of two.
+// each cell carries a sequence number so producers claim cells with one CAS and publish them
+// without blocking each other or the consumer:
+template <typename T, size_t N>
+class trex_mpsc {
+    static_assert((N & (N - 1)) == 0, "N must be a power of two");
+
+public:
+    trex_mpsc() {
+        for (size_t i = 0; i < N; i++) {
+            cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // any thread; returns false if full:
+    bool push(const T &v) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        for (;;) {
+            cell &c = cells[t & (N - 1)];
+            size_t seq = c.seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)t;
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(t, t + 1, std::memory_order_relaxed)) {
+                    c.item = v;
+                    c.seq.store(t + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                t = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // consumer thread only; returns false if empty or the next item is not yet published:
+    bool pop(T &o_v) {
+        cell &c = cells[head & (N - 1)];
+        if (c.seq.load(std::memory_order_acquire) != head + 1) {
+            return false;
+        }
+        o_v = c.item;
+        c.seq.store(head + N, std::memory_order_release);
+        head++;
+        return true;
+    }
+
+private:
+    struct cell {
+        std::atomic<size_t> seq;
+        T                   item;
+    };
+
+    alignas(64) std::atomic<size_t> tail{0};
+    alignas(64) size_t              head = 0;
+    cell cells[N];
+};
+
+enum trex_command_kind {
+    COMMAND_CREATE,
+    COMMAND_DEFINE_STATE,
+    COMMAND_RUN,
+    COMMAND_STOP,
+    COMMAND_DELETE,
+};
+
+// a state machine lifecycle request for trex_host::submit():
+struct trex_command {
+    enum trex_command_kind kind;
+    // echoed back in the reply:
+    uint32_t seq;
+    uint32_t name;
+
+    // COMMAND_CREATE:
+    uint8_t  iterations;
+    uint8_t  locals_count;
+    uint16_t handlers_count;
+    uint32_t code_size;
+
+    // COMMAND_DEFINE_STATE; the submitter keeps code alive until the reply arrives:
+    uint16_t       state;
+    const uint8_t *code;
+};
+
+struct trex_reply {
+    uint32_t         seq;
+    enum trex_result result;
+};
+
+// a message sent by a state machine:
+struct trex_message {
+    uint32_t name;
+    uint8_t  size;
+    uint8_t  data[TREX_MESSAGE_SIZE];
+};
+
+// owns the queues around a single context:
+template <size_t Commands = 64, size_t Messages = 64>
+class trex_host {
+public:
+    explicit trex_host(struct trex_context *ctx) : ctx(ctx) {}
+
+    // any thread; returns false if the command queue is full:
+    bool submit(const trex_command &cmd) {
+        return commands.push(cmd);
+    }
+
+    // exec thread, between trex_exec() calls; applies at most max queued commands so the exec
+    // thread is never held up by a burst. returns the number of commands applied:
+    unsigned drain(unsigned max = Commands) {
+        unsigned n = 0;
+        trex_command cmd;
+        // never pop a command whose reply could not be delivered:
+        while (n < max && !replies.full() && commands.pop(cmd)) {
+            replies.push(trex_reply{cmd.seq, apply(cmd)});
+            n++;
+        }
+        return n;
+    }
+
+    // exec thread, typically from a syscall; returns false if the message queue is full:
+    bool post_message(uint32_t name, const void *data, uint8_t size) {
+        trex_message m;
+        m.name = name;
+        m.size = size <= sizeof(m.data) ? size : sizeof(m.data);
+        memcpy(m.data, data, m.size);
+        return messages.push(m);
+    }
+
+    // ctx->message_send for the built-in message-send syscall, with this host as ctx->hostdata:
+    static int message_send(struct trex_context *ctx, const uint8_t *data, uint8_t size) {
+        auto *host = static_cast<trex_host *>(ctx->hostdata);
+        return host->post_message(ctx->sm->name, data, size);
+    }
+
+    // host I/O thread; returns false if nothing is available:
+    bool receive_reply(trex_reply &o_reply) {
+        return replies.pop(o_reply);
+    }
+
+    // host I/O thread; returns false if nothing is available:
+    bool receive_message(trex_message &o_message) {
+        return messages.pop(o_message);
+    }
+
+private:
+    enum trex_result apply(const trex_command &cmd) {
+        switch (cmd.kind) {
+            case COMMAND_CREATE:
+                return trex_sm_create(ctx, cmd.name, cmd.iterations, cmd.locals_count, cmd.handlers_count, cmd.code_size);
+            case COMMAND_DEFINE_STATE:
+                return trex_sm_define_state(ctx, cmd.name, cmd.state, cmd.code, cmd.code_size);
+            case COMMAND_RUN:
+                return trex_sm_run(ctx, cmd.name);
+            case COMMAND_STOP:
+                return trex_sm_stop(ctx, cmd.name);
+            case COMMAND_DELETE:
+                return trex_sm_delete(ctx, cmd.name);
+        }
+        return RESULT_INVALID_STATE;
+    }
+
+    struct trex_context *ctx;
+
+    trex_mpsc<trex_command, Commands> commands;
+    trex_spsc<trex_reply, Commands>   replies;
+    trex_spsc<trex_message, Messages> messages;
+};
@@ -0,0 +1,157 @@
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "trex.h"
+#include "trex_impl.h"
+
+// a wakes before b; wrap-safe so host time may roll over:
+static inline int wakes_before(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+static void sift_up(struct trex_sleeper *h, unsigned i) {
+    struct trex_sleeper e = h[i];
+    while (i > 0) {
+        unsigned parent = (i - 1) / 2;
+        if (!wakes_before(e.wake_at, h[parent].wake_at)) {
+            break;
+        }
+        h[i] = h[parent];
+        i = parent;
+    }
+    h[i] = e;
+}
+
+static void sift_down(struct trex_sleeper *h, unsigned n, unsigned i) {
+    struct trex_sleeper e = h[i];
+    for (;;) {
+        unsigned c = 2 * i + 1;
+        if (c >= n) {
+            break;
+        }
+        if (c + 1 < n && wakes_before(h[c + 1].wake_at, h[c].wake_at)) {
+            c++;
+        }
+        if (!wakes_before(h[c].wake_at, e.wake_at)) {
+            break;
+        }
+        h[i] = h[c];
+        i = c;
+    }
+    h[i] = e;
+}
+
+// remove heap entry i:
+static void heap_remove(struct trex_context *ctx, unsigned i) {
+    struct trex_sleeper *h = ctx->sleepers;
+    unsigned n = --ctx->sleepers_count;
+    if (i == n) {
+        return;
+    }
+    h[i] = h[n];
+    sift_down(h, n, i);
+    sift_up(h, i);
+}
+
+void trex_sleepers_init(struct trex_context *ctx, struct trex_sleeper *sleepers, uint16_t cap) {
+    ctx->sleepers = sleepers;
+    ctx->sleepers_count = 0;
+    ctx->sleepers_cap = cap;
+}
+
+int trex_next_wake(const struct trex_context *ctx, uint32_t *o_wake_at) {
+    if (ctx->sleepers_count == 0) {
+        return 0;
+    }
+    *o_wake_at = ctx->sleepers[0].wake_at;
+    return 1;
+}
+
+void trex_sleep_park(struct trex_context *ctx, struct trex_sm *sm) {
+    sm->sleeping = 0;
+
+    // a deadline that has already passed does not sleep at all:
+    if (!wakes_before(ctx->now, sm->wake_at)) {
+        return;
+    }
+
+    // the syscall checked for room before requesting the sleep:
+    unsigned i = ctx->sleepers_count++;
+    ctx->sleepers[i].wake_at = sm->wake_at;
+    ctx->sleepers[i].machine = (uint16_t)(sm - ctx->machines);
+    sift_up(ctx->sleepers, i);
+
+    sm->exec_status = SLEEPING;
+}
+
+void trex_sleep_wake(struct trex_context *ctx) {
+    struct trex_sleeper *h = ctx->sleepers;
+    while (ctx->sleepers_count && !wakes_before(ctx->now, h[0].wake_at)) {
+        struct trex_sm *sm = &ctx->machines[h[0].machine];
+        heap_remove(ctx, 0);
+        if (sm->exec_status == SLEEPING) {
+            sm->exec_status = READY;
+            sm->deadline = ctx->clock + sm->latency;
+        }
+    }
+}
+
+void trex_sleep_cancel(struct trex_context *ctx, struct trex_sm *sm) {
+    sm->sleeping = 0;
+
+    uint16_t m = (uint16_t)(sm - ctx->machines);
+    for (unsigned i = 0; i < ctx->sleepers_count; i++) {
+        if (ctx->sleepers[i].machine == m) {
+            heap_remove(ctx, i);
+            return;
+        }
+    }
+}
+
+int trex_sleep_rebuild(struct trex_context *ctx) {
+    ctx->sleepers_count = 0;
+    for (unsigned m = 0; m < ctx->machines_count; m++) {
+        const struct trex_sm *sm = &ctx->machines[m];
+        if (sm->exec_status != SLEEPING) {
+            continue;
+        }
+        if (ctx->sleepers_count >= ctx->sleepers_cap) {
+            return 0;
+        }
+        unsigned i = ctx->sleepers_count++;
+        ctx->sleepers[i].wake_at = sm->wake_at;
+        ctx->sleepers[i].machine = (uint16_t)m;
+        sift_up(ctx->sleepers, i);
+    }
+    return 1;
+}
+
+// request a sleep until the given host time, applied once the handler returns:
+static void sleep_request(struct trex_context *ctx, uint32_t wake_at) {
+    if (ctx->sleepers_count >= ctx->sleepers_cap) {
+        ctx->sm->exec_status = ERROR_SYSC_INVALID_STATE;
+        return;
+    }
+    ctx->sm->sleeping = 1;
+    ctx->sm->wake_at = wake_at;
+}
+
+void trex_sys_sleep(struct trex_context *ctx) {
+    uint32_t ticks;
+    trex_pop(ctx, &ticks);
+    sleep_request(ctx, ctx->now + ticks);
+}
+
+void trex_sys_sleep_until(struct trex_context *ctx) {
+    uint32_t time;
+    trex_pop(ctx, &time);
+    sleep_request(ctx, time);
+}
+
+#ifdef __cplusplus
+}
+#endif
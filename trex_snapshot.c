@@ -0,0 +1,401 @@
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#include "trex.h"
+#include "trex_impl.h"
+
+#define SNAPSHOT_MAGIC  0x53585254u // "TRXS"
+#define SNAPSHOT_NONE   0xFFFFFFFFu
+
+// header: magic, machines_count, stack size, total locals, channels_count
+#define SNAPSHOT_HEADER_SIZE   (4 + 2 + 2 + 4 + 1)
+// context: a, registers, pc offset, loop pc offset, loop index, loop count, sp depth, current machine
+// index, curr_machine, schedule_next, slot_cycles, iterations_remaining, clock, now, chip_curr, chip_addr, message_size, message
+#define SNAPSHOT_CONTEXT_SIZE  (4 + 4 * TREX_REGISTERS + 4 + 4 + 4 + 4 + 2 + 2 + 4 + 4 + 4 + 4 + 4 + 4 + 1 + 4 + 1 + TREX_MESSAGE_SIZE)
+// each machine: exec_status, stopping, sleeping, wake_at, waiting, channel, deadline, st, nxst,
+// then its locals
+#define SNAPSHOT_MACHINE_SIZE  (1 + 1 + 1 + 4 + 1 + 1 + 4 + 2 + 2)
+// each channel: head, tail, waiter, then its ring
+#define SNAPSHOT_CHANNEL_SIZE  (2 + 2 + 2)
+
+static uint32_t locals_total(const struct trex_context *ctx) {
+    uint32_t n = 0;
+    for (unsigned i = 0; i < ctx->machines_count; i++) {
+        n += ctx->machines[i].locals_count;
+    }
+    return n;
+}
+
+static uint32_t channels_size(const struct trex_context *ctx) {
+    uint32_t n = 0;
+    for (unsigned c = 0; c < ctx->channels_count; c++) {
+        n += SNAPSHOT_CHANNEL_SIZE + (ctx->channels[c].mask + 1u) * 4;
+    }
+    return n;
+}
+
+uint32_t trex_snapshot_size(const struct trex_context *ctx) {
+    return SNAPSHOT_HEADER_SIZE
+        + SNAPSHOT_CONTEXT_SIZE
+        + (uint32_t)(ctx->stack_max - ctx->stack_min) * 4
+        + ctx->machines_count * SNAPSHOT_MACHINE_SIZE
+        + locals_total(ctx) * 4
+        + channels_size(ctx);
+}
+
+enum trex_result trex_snapshot_save(const struct trex_context *ctx, uint8_t *buf, uint32_t size) {
+    if (size < trex_snapshot_size(ctx)) {
+        return RESULT_OUT_OF_MEMORY;
+    }
+
+    uint8_t *p = buf;
+    const uint32_t stack_size = (uint32_t)(ctx->stack_max - ctx->stack_min);
+
+    st32(&p, SNAPSHOT_MAGIC);
+    st16(&p, ctx->machines_count);
+    st16(&p, stack_size);
+    st32(&p, locals_total(ctx));
+    st8(&p, ctx->channels_count);
+
+    // pc and sp only mean something while a handler is in progress:
+    const struct trex_sm *sm = ctx->sm;
+    uint32_t pc_offset = SNAPSHOT_NONE;
+    uint32_t loop_pc_offset = SNAPSHOT_NONE;
+    uint32_t sp_depth = 0;
+    if (sm && sm->exec_status == EXECUTING) {
+        const struct trex_sh *sh = &sm->handlers[sm->st];
+        pc_offset = (uint32_t)(ctx->pc - sh->pc_start);
+        if (ctx->loop_pc >= sh->pc_start && ctx->loop_pc < sh->pc_end) {
+            loop_pc_offset = (uint32_t)(ctx->loop_pc - sh->pc_start);
+        }
+        sp_depth = (uint32_t)(ctx->stack_max - ctx->sp);
+    }
+
+    st32(&p, ctx->a);
+    for (int r = 0; r < TREX_REGISTERS; r++) {
+        st32(&p, ctx->r[r]);
+    }
+    st32(&p, pc_offset);
+    st32(&p, loop_pc_offset);
+    st32(&p, ctx->loop_index);
+    st32(&p, ctx->loop_count);
+    st16(&p, sp_depth);
+    st16(&p, sm ? (uint32_t)(sm - ctx->machines) : 0xFFFF);
+    st32(&p, ctx->curr_machine);
+    st32(&p, ctx->schedule_next);
+    st32(&p, ctx->slot_cycles);
+    st32(&p, (uint32_t)ctx->iterations_remaining);
+    st32(&p, ctx->clock);
+    st32(&p, ctx->now);
+    st8(&p, ctx->chip_curr);
+    st32(&p, ctx->chip_addr);
+    st8(&p, ctx->message_size);
+    memcpy(p, ctx->message, TREX_MESSAGE_SIZE);
+    p += TREX_MESSAGE_SIZE;
+
+    for (uint32_t i = 0; i < stack_size; i++) {
+        st32(&p, ctx->stack_min[i]);
+    }
+
+    for (unsigned i = 0; i < ctx->machines_count; i++) {
+        const struct trex_sm *m = &ctx->machines[i];
+        st8(&p, m->exec_status);
+        st8(&p, m->stopping);
+        st8(&p, m->sleeping);
+        st32(&p, m->wake_at);
+        st8(&p, m->waiting);
+        st8(&p, m->channel);
+        st32(&p, m->deadline);
+        st16(&p, m->st);
+        st16(&p, m->nxst);
+        for (unsigned l = 0; l < m->locals_count; l++) {
+            st32(&p, m->locals[l]);
+        }
+    }
+
+    for (unsigned c = 0; c < ctx->channels_count; c++) {
+        const struct trex_channel *ch = &ctx->channels[c];
+        st16(&p, ch->head);
+        st16(&p, ch->tail);
+        st16(&p, ch->waiter);
+        for (uint32_t i = 0; i <= ch->mask; i++) {
+            st32(&p, ch->buf[i]);
+        }
+    }
+
+    return RESULT_OK;
+}
+
+// check everything a snapshot would restore before any of it is written, so that a rejected
+// snapshot leaves the context as it was. p points past the header:
+static int snapshot_valid(const struct trex_context *ctx, uint8_t *p) {
+    const uint32_t stack_size = (uint32_t)(ctx->stack_max - ctx->stack_min);
+
+    p += 4 + 4 * TREX_REGISTERS;
+    uint32_t pc_offset = ld32(&p);
+    uint32_t loop_pc_offset = ld32(&p);
+    p += 4 + 4;
+    uint32_t sp_depth = ld16(&p);
+    uint32_t sm_index = ld16(&p);
+    if (sp_depth > stack_size || (sm_index != 0xFFFF && sm_index >= ctx->machines_count)) {
+        return 0;
+    }
+    p += 4 + 4 + 4 + 4 + 4 + 4 + 1 + 4;
+    if (ld8(&p) > TREX_MESSAGE_SIZE) {
+        return 0;
+    }
+    p += TREX_MESSAGE_SIZE;
+    p += stack_size * 4;
+
+    unsigned sleepers = 0;
+    for (unsigned i = 0; i < ctx->machines_count; i++) {
+        const struct trex_sm *m = &ctx->machines[i];
+        uint32_t status = ld8(&p);
+        p += 1 + 1 + 4;
+        uint32_t waiting = ld8(&p);
+        uint32_t channel = ld8(&p);
+        p += 4;
+        uint32_t st = ld16(&p);
+        uint32_t nxst = ld16(&p);
+        p += m->locals_count * 4;
+
+        if (status >= __EXEC_STATUS_COUNT) {
+            return 0;
+        }
+        // the state numbers index the handlers; a machine without handlers never runs:
+        if (m->handlers_count ? (st >= m->handlers_count || nxst >= m->handlers_count) : status != NOT_EXECUTABLE) {
+            return 0;
+        }
+        // only the current machine can be in the middle of a handler:
+        if ((status == EXECUTING || status == IN_SYSCALL) && (i != sm_index || pc_offset == SNAPSHOT_NONE)) {
+            return 0;
+        }
+        if ((waiting || status == WAITING) && channel >= ctx->channels_count) {
+            return 0;
+        }
+        if (status == SLEEPING) {
+            sleepers++;
+        }
+
+        // a saved pc belongs to the handler in progress:
+        if (i == sm_index && pc_offset != SNAPSHOT_NONE) {
+            if (status != EXECUTING && status != IN_SYSCALL) {
+                return 0;
+            }
+            const struct trex_sh *sh = &m->handlers[st];
+            if (pc_offset > (uint32_t)(sh->pc_end - sh->pc_start)) {
+                return 0;
+            }
+            if (loop_pc_offset != SNAPSHOT_NONE && loop_pc_offset >= (uint32_t)(sh->pc_end - sh->pc_start)) {
+                return 0;
+            }
+        }
+    }
+    // the sleeper heap is rebuilt from the SLEEPING machines:
+    if (sleepers > ctx->sleepers_cap) {
+        return 0;
+    }
+
+    for (unsigned c = 0; c < ctx->channels_count; c++) {
+        const struct trex_channel *ch = &ctx->channels[c];
+        uint16_t head = (uint16_t)ld16(&p);
+        uint16_t tail = (uint16_t)ld16(&p);
+        uint32_t waiter = ld16(&p);
+        p += (ch->mask + 1u) * 4;
+        if ((uint16_t)(tail - head) > ch->mask + 1u || waiter > ctx->machines_count) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+enum trex_result trex_snapshot_restore(struct trex_context *ctx, const uint8_t *buf, uint32_t size) {
+    if (size < trex_snapshot_size(ctx)) {
+        return RESULT_INVALID_SNAPSHOT;
+    }
+
+    uint8_t *p = (uint8_t *)buf;
+    const uint32_t stack_size = (uint32_t)(ctx->stack_max - ctx->stack_min);
+
+    // the snapshot must come from an identically configured context:
+    if (ld32(&p) != SNAPSHOT_MAGIC
+     || ld16(&p) != ctx->machines_count
+     || ld16(&p) != stack_size
+     || ld32(&p) != locals_total(ctx)
+     || ld8(&p) != ctx->channels_count
+    ) {
+        return RESULT_INVALID_SNAPSHOT;
+    }
+    if (!snapshot_valid(ctx, p)) {
+        return RESULT_INVALID_SNAPSHOT;
+    }
+
+    // nothing below can fail:
+    ctx->a = ld32(&p);
+    for (int n = 0; n < TREX_REGISTERS; n++) {
+        ctx->r[n] = ld32(&p);
+    }
+    uint32_t pc_offset = ld32(&p);
+    uint32_t loop_pc_offset = ld32(&p);
+    ctx->loop_index = ld32(&p);
+    ctx->loop_count = ld32(&p);
+    uint32_t sp_depth = ld16(&p);
+    uint32_t sm_index = ld16(&p);
+    ctx->sm = (sm_index != 0xFFFF) ? &ctx->machines[sm_index] : 0;
+    ctx->curr_machine = ld32(&p);
+    ctx->schedule_next = ld32(&p);
+    ctx->slot_cycles = ld32(&p);
+    ctx->iterations_remaining = (int)ld32(&p);
+    ctx->clock = ld32(&p);
+    ctx->now = ld32(&p);
+    ctx->chip_curr = (uint8_t)ld8(&p);
+    ctx->chip_addr = ld32(&p);
+    ctx->message_size = (uint8_t)ld8(&p);
+    memcpy(ctx->message, p, TREX_MESSAGE_SIZE);
+    p += TREX_MESSAGE_SIZE;
+
+    for (uint32_t i = 0; i < stack_size; i++) {
+        ctx->stack_min[i] = ld32(&p);
+    }
+
+    for (unsigned i = 0; i < ctx->machines_count; i++) {
+        struct trex_sm *m = &ctx->machines[i];
+        m->exec_status = (enum exec_status)ld8(&p);
+        m->stopping = (uint8_t)ld8(&p);
+        m->sleeping = (uint8_t)ld8(&p);
+        m->wake_at = ld32(&p);
+        m->waiting = (uint8_t)ld8(&p);
+        m->channel = (uint8_t)ld8(&p);
+        m->deadline = ld32(&p);
+        m->st = (uint16_t)ld16(&p);
+        m->nxst = (uint16_t)ld16(&p);
+        for (unsigned l = 0; l < m->locals_count; l++) {
+            m->locals[l] = ld32(&p);
+        }
+    }
+
+    for (unsigned c = 0; c < ctx->channels_count; c++) {
+        struct trex_channel *ch = &ctx->channels[c];
+        ch->head = (uint16_t)ld16(&p);
+        ch->tail = (uint16_t)ld16(&p);
+        ch->waiter = (uint16_t)ld16(&p);
+        for (uint32_t i = 0; i <= ch->mask; i++) {
+            ch->buf[i] = ld32(&p);
+        }
+    }
+
+    // the sleeper heap is derived from the machines rather than saved:
+    trex_sleep_rebuild(ctx);
+
+    ctx->sp = ctx->stack_max - sp_depth;
+    ctx->pc = 0;
+    ctx->loop_pc = 0;
+    if (ctx->sm && pc_offset != SNAPSHOT_NONE) {
+        const struct trex_sh *sh = &ctx->sm->handlers[ctx->sm->st];
+        ctx->pc = sh->pc_start + pc_offset;
+        if (loop_pc_offset != SNAPSHOT_NONE) {
+            ctx->loop_pc = sh->pc_start + loop_pc_offset;
+        }
+    }
+
+    return RESULT_OK;
+}
+
+// unchanged gaps shorter than a run header are cheaper to copy than to skip:
+#define DELTA_MIN_GAP 4
+
+enum trex_result trex_snapshot_delta(
+    const uint8_t *base,
+    const uint8_t *curr,
+    uint32_t       size,
+    uint8_t       *out,
+    uint32_t       out_size,
+    uint32_t      *o_delta_size
+) {
+    uint8_t *p = out;
+    uint32_t i = 0;
+    uint32_t last = 0; // end of the previous run
+
+    while (i < size) {
+        // find the start of the next changed run:
+        i = trex_mismatch(base, curr, i, size);
+        if (i >= size) {
+            break;
+        }
+
+        // extend the run until DELTA_MIN_GAP unchanged bytes in a row:
+        uint32_t start = i;
+        uint32_t end = i;
+        while (i < size && i - end < DELTA_MIN_GAP && i - start < 0xFFFF) {
+            if (base[i] != curr[i]) {
+                end = i + 1;
+            }
+            i++;
+        }
+
+        // skips longer than a u16 are split into empty runs:
+        while (start - last > 0xFFFF) {
+            if ((uint32_t)(p - out) + 4 > out_size) {
+                return RESULT_OUT_OF_MEMORY;
+            }
+            st16(&p, 0xFFFF);
+            st16(&p, 0);
+            last += 0xFFFF;
+        }
+
+        uint32_t len = end - start;
+        if ((uint32_t)(p - out) + 4 + len > out_size) {
+            return RESULT_OUT_OF_MEMORY;
+        }
+        st16(&p, start - last);
+        st16(&p, len);
+        memcpy(p, curr + start, len);
+        p += len;
+
+        last = end;
+        i = end;
+    }
+
+    *o_delta_size = (uint32_t)(p - out);
+    return RESULT_OK;
+}
+
+enum trex_result trex_snapshot_apply_delta(
+    uint8_t       *snapshot,
+    uint32_t       size,
+    const uint8_t *delta,
+    uint32_t       delta_size
+) {
+    uint8_t *p = (uint8_t *)delta;
+    uint8_t *p_end = p + delta_size;
+    uint32_t offset = 0;
+
+    while (p < p_end) {
+        if (p_end - p < 4) {
+            return RESULT_INVALID_SNAPSHOT;
+        }
+        uint32_t skip = ld16(&p);
+        uint32_t len = ld16(&p);
+        offset += skip;
+        if ((uint32_t)(p_end - p) < len || offset + len > size) {
+            return RESULT_INVALID_SNAPSHOT;
+        }
+        memcpy(snapshot + offset, p, len);
+        p += len;
+        offset += len;
+    }
+
+    return RESULT_OK;
+}
+
+#undef DELTA_MIN_GAP
+
+#ifdef __cplusplus
+}
+#endif
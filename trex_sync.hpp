@@ -0,0 +1,85 @@
+#pragma once
+
+// host-side helper that attaches a trex context to an emulator's video timing so state machines
+// run at exact emulated moments instead of whenever the host thread gets around to it.
+//
+// the emulator calls scanline() at the start of every scanline and, for per-CPU-cycle budgets,
+// cpu_cycles() as the emulated CPU advances. ctx->now counts scanlines since power on, so it can
+// serve as the time base for machines. all arithmetic is integer, so the same emulated timeline
+// always produces the same trex execution.
+
+#include <cstdint>
+#include <vector>
+
+extern "C" {
+#include "trex.h"
+}
+
+class trex_frame_sync {
+public:
+    // a frame has at least one scanline:
+    trex_frame_sync(struct trex_context *ctx, uint16_t scanlines_per_frame)
+        : ctx(ctx)
+        , budgets(scanlines_per_frame ? scanlines_per_frame : 1, 0)
+    {}
+
+    // run once per frame at the start of the given scanline, e.g. the first line of vblank:
+    void at_vblank(uint16_t line, int cycles) {
+        clear();
+        budgets[line % budgets.size()] = cycles;
+    }
+
+    // run at the start of each of the given scanlines:
+    void at_scanlines(const std::vector<uint16_t> &lines, int cycles) {
+        clear();
+        for (uint16_t line : lines) {
+            budgets[line % budgets.size()] = cycles;
+        }
+    }
+
+    // run at the start of every scanline with a budget of num/den trex cycles per emulated CPU
+    // cycle since the previous scanline; fractions carry over to the next scanline:
+    void per_cpu_cycles(uint32_t num, uint32_t den) {
+        clear();
+        cpu_num = num;
+        cpu_den = den ? den : 1;
+    }
+
+    // emulator hook; emulated CPU cycles elapsed:
+    void cpu_cycles(uint32_t n) {
+        credit += (uint64_t)n * cpu_num;
+    }
+
+    // emulator hook; start of a scanline:
+    void scanline(uint16_t line) {
+        now++;
+
+        int cycles = budgets[line % budgets.size()];
+        if (cpu_num) {
+            cycles = (int)(credit / cpu_den);
+            credit %= cpu_den;
+        }
+        if (cycles > 0) {
+            trex_exec_at(ctx, now, cycles);
+        }
+    }
+
+private:
+    void clear() {
+        for (int &b : budgets) {
+            b = 0;
+        }
+        cpu_num = 0;
+        cpu_den = 1;
+        credit = 0;
+    }
+
+    struct trex_context *ctx;
+    std::vector<int>     budgets;
+
+    uint32_t cpu_num = 0;
+    uint32_t cpu_den = 1;
+    uint64_t credit = 0;
+
+    uint32_t now = 0;
+};
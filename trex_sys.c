@@ -0,0 +1,99 @@
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "trex.h"
+#include "trex_impl.h"
+
+// room for n more bytes in the message, else fail the syscall:
+static inline uint8_t *message_span(struct trex_context *ctx, uint32_t n) {
+    if (n > (uint32_t)TREX_MESSAGE_SIZE - ctx->message_size) {
+        ctx->sm->exec_status = ERROR_SYSC_INVALID_ARG;
+        return 0;
+    }
+    uint8_t *m = ctx->message + ctx->message_size;
+    ctx->message_size += n;
+    return m;
+}
+
+void trex_sys_message_append_byte(struct trex_context *ctx) {
+    uint32_t a;
+    trex_pop(ctx, &a);
+    uint8_t *m = message_span(ctx, 1);
+    if (!m) {
+        return;
+    }
+    m[0] = (uint8_t)a;
+}
+
+void trex_sys_message_append_word(struct trex_context *ctx) {
+    uint32_t a;
+    trex_pop(ctx, &a);
+    uint8_t *m = message_span(ctx, 2);
+    if (!m) {
+        return;
+    }
+    m[0] = (uint8_t)a;
+    m[1] = (uint8_t)(a >> 8);
+}
+
+void trex_sys_message_append_dword(struct trex_context *ctx) {
+    uint32_t a;
+    trex_pop(ctx, &a);
+    uint8_t *m = message_span(ctx, 4);
+    if (!m) {
+        return;
+    }
+    m[0] = (uint8_t)a;
+    m[1] = (uint8_t)(a >> 8);
+    m[2] = (uint8_t)(a >> 16);
+    m[3] = (uint8_t)(a >> 24);
+}
+
+void trex_sys_message_send(struct trex_context *ctx) {
+    if (!ctx->message_send) {
+        ctx->sm->exec_status = ERROR_SYSC_INVALID_STATE;
+        return;
+    }
+    if (!ctx->message_send(ctx, ctx->message, ctx->message_size)) {
+        // host is backed up; keep the message for a retry:
+        trex_push(ctx, 0);
+        return;
+    }
+    ctx->message_size = 0;
+    trex_push(ctx, 1);
+}
+
+// append dwords from locals starting at the given local:
+void trex_sys_message_append_locals(struct trex_context *ctx) {
+    uint32_t local, dwords;
+    trex_pop(ctx, &dwords);
+    trex_pop(ctx, &local);
+
+    const uint32_t *l = locals_span(ctx, local, dwords);
+    if (!l) {
+        return;
+    }
+    uint8_t *m = message_span(ctx, dwords * 4);
+    if (!m) {
+        return;
+    }
+    for (uint32_t n = 0; n < dwords; n++) {
+        st32(&m, l[n]);
+    }
+}
+
+void trex_sys_time_now(struct trex_context *ctx) {
+    trex_push(ctx, ctx->now);
+}
+
+void trex_sys_time_clock(struct trex_context *ctx) {
+    trex_push(ctx, ctx->clock);
+}
+
+#ifdef __cplusplus
+}
+#endif
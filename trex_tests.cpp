@@ -3,12 +3,21 @@
 #include <array>
 #include <iostream>
 #include <iomanip>
+#include <cstring>
+#include <sstream>
 
 extern "C" {
 #include "trex.h"
 #include "trex_opcodes.h"
 }
 
+#include "trex_trace.hpp"
+#include "trex_pool.hpp"
+#include "trex_queue.hpp"
+#include "trex_sync.hpp"
+#include "trex.hpp"
+#include "trex_builder.hpp"
+
 constexpr std::array verify_status_names = {
     std::string_view{"UNVERIFIED"},
     std::string_view{"VERIFIED"},
@@ -23,93 +32,20 @@ constexpr std::array verify_status_names = {
     std::string_view{"INVALID_STATE"},
     std::string_view{"INVALID_SYSCALL_NUMBER"},
     std::string_view{"INVALID_SYSCALL_UNMAPPED"},
+    std::string_view{"INVALID_BITFIELD"},
+    std::string_view{"INVALID_REGISTER"},
+    std::string_view{"INVALID_LOOP"},
+    std::string_view{"INVALID_CONSTANT"},
 };
 
-uint32_t chip_curr = 0;
-struct {
-    uint32_t addr;
-    uint8_t  mem[512];
-} chips[2];
+uint8_t chip_mem[2][512];
+struct trex_chip chips[2] = {
+    {chip_mem[0], sizeof(chip_mem[0])}, // 0: wram
+    {chip_mem[1], sizeof(chip_mem[1])}, // 1: nmix
+};
 
 struct trex_syscall syscalls[] = {
-    { // 0:
-        .name = "chip-use",
-        .args = 1,
-        .call = [](struct trex_context *ctx){
-            uint32_t a;
-            trex_pop(ctx, &a);
-            chip_curr = a;
-        },
-    },
-    { // 1:
-        .name = "chip-address-set",
-        .args = 1,
-        .call = [](struct trex_context *ctx){
-            uint32_t a;
-            trex_pop(ctx, &a);
-            chips[chip_curr].addr = a;
-        },
-    },
-    { // 2:
-        .name = "chip-read-no-advance-byte",
-        .returns = 1,
-        .call = [](struct trex_context *ctx){
-            trex_push(ctx,
-                chips[chip_curr].mem[chips[chip_curr].addr]
-            );
-        },
-    },
-    { // 3:
-        .name = "chip-read-advance-byte",
-        .returns = 1,
-        .call = [](struct trex_context *ctx){
-            trex_push(ctx,
-                chips[chip_curr].mem[chips[chip_curr].addr++]
-            );
-        },
-    },
-    { // 4:
-        .name = "chip-read-dword",
-        .returns = 1,
-        .call = [](struct trex_context *ctx){
-            uint32_t a;
-            a  = chips[chip_curr].mem[chips[chip_curr].addr++];
-            a |= chips[chip_curr].mem[chips[chip_curr].addr++] << 8;
-            a |= chips[chip_curr].mem[chips[chip_curr].addr++] << 16;
-            a |= chips[chip_curr].mem[chips[chip_curr].addr++] << 24;
-            trex_push(ctx, a);
-        },
-    },
-    { // 5:
-        .name = "chip-write-no-advance-byte",
-        .args = 1,
-        .call = [](struct trex_context *ctx){
-            uint32_t a;
-            trex_pop(ctx, &a);
-            chips[chip_curr].mem[chips[chip_curr].addr] = a;
-        },
-    },
-    { // 6:
-        .name = "chip-write-advance-byte",
-        .args = 1,
-        .call = [](struct trex_context *ctx){
-            uint32_t a;
-            trex_pop(ctx, &a);
-            chips[chip_curr].mem[chips[chip_curr].addr++] = a;
-        },
-    },
-    { // 7:
-        .name = "chip-write-dword",
-        .args = 1,
-        .call = [](struct trex_context *ctx){
-            uint32_t a;
-            trex_pop(ctx, &a);
-            chips[chip_curr].mem[chips[chip_curr].addr++] = a;
-            chips[chip_curr].mem[chips[chip_curr].addr++] = a >> 8;
-            chips[chip_curr].mem[chips[chip_curr].addr++] = a >> 16;
-            chips[chip_curr].mem[chips[chip_curr].addr++] = a >> 24;
-        },
-    },
+    TREX_CHIP_SYSCALLS,
 };
 
 bool verify_sh(struct trex_context &ctx, struct trex_sm &sm, struct trex_sh &sh) {
@@ -877,13 +813,84 @@ int test_branch_verify(struct trex_context &ctx) {
     return 0;
 }
 
-int main() {
+int test_arena() {
+    std::cout << "arena:" << std::endl;
+
+    static uint8_t mem[1024];
+    struct trex_arena arena;
+    trex_arena_init(&arena, mem, sizeof(mem));
+
     struct trex_context ctx;
-    struct trex_sm machines[1];
+    auto *stack = (uint32_t *)trex_arena_alloc_fixed(&arena, 16 * sizeof(uint32_t));
+    trex_context_init(
+        &ctx,
+        nullptr,
+        stack,
+        16,
+        1024,
+        sizeof(syscalls)/sizeof(struct trex_syscall),
+        syscalls
+    );
+    ctx.arena = &arena;
 
-    uint32_t stack[16]  = {0};
-    uint32_t locals[16] = {0};
+    auto *machines = (struct trex_sm *)trex_arena_alloc_fixed(&arena, 3 * sizeof(struct trex_sm));
+    ctx.machines_count = 3;
+    ctx.machines = machines;
+
+    // each machine stores its index + 1 into local 0:
+    for (int i = 0; i < 3; i++) {
+        uint8_t code[] = {
+            IMM1, (uint8_t)(i + 1),
+            STL1, 0,
+            RET,
+        };
+
+        // blocks of different sizes, so a wrong relocation is caught:
+        trex_sm_init(&ctx, &machines[i], 1, 0, nullptr);
+        if (trex_sm_alloc(&ctx, &machines[i], 1, 1, sizeof(code) + 16 * i) != RESULT_OK) {
+            std::cout << "  alloc failed" << std::endl;
+            return 1;
+        }
+        memcpy(trex_sm_code(&machines[i]), code, sizeof(code));
+        machines[i].handlers[0].pc_end += sizeof(code);
+        trex_sm_verify(&ctx, &machines[i], machines[i].handlers_count, machines[i].handlers);
+    }
+
+    // free the middle machine; the last machine must be compacted into its place and keep working:
+    struct trex_block *hole = machines[1].block;
+    uint32_t hole_size = hole->size;
+    uint32_t lo = arena.lo;
+    trex_sm_free(&ctx, &machines[1]);
+    if (machines[2].block != hole || arena.lo != lo - hole_size || hole_size == machines[2].block->size) {
+        std::cout << "  compaction failed" << std::endl;
+        return 1;
+    }
+
+    trex_exec(&ctx);
+    std::cout << "  locals = " << machines[0].locals[0] << " " << machines[2].locals[0] << std::endl;
+    if (machines[0].locals[0] != 1 || machines[2].locals[0] != 3) {
+        return 1;
+    }
+
+    // running out of memory is a clean error:
+    if (trex_sm_alloc(&ctx, &machines[1], 1, 1, sizeof(mem)) != RESULT_OUT_OF_MEMORY) {
+        std::cout << "  expected out of memory" << std::endl;
+        return 1;
+    }
+
+    std::cout << "  high_water = " << std::dec << arena.high_water << " of " << arena.size << std::endl;
+    return 0;
+}
 
+int test_machines() {
+    std::cout << "machines:" << std::endl;
+
+    static uint8_t mem[4096];
+    struct trex_arena arena;
+    trex_arena_init(&arena, mem, sizeof(mem));
+
+    struct trex_context ctx;
+    auto *stack = (uint32_t *)trex_arena_alloc_fixed(&arena, 16 * sizeof(uint32_t));
     trex_context_init(
         &ctx,
         nullptr,
@@ -893,21 +900,2066 @@ int main() {
         sizeof(syscalls)/sizeof(struct trex_syscall),
         syscalls
     );
+    ctx.arena = &arena;
+
+    if (trex_machines_alloc(&ctx, 8) != RESULT_OK) {
+        return 1;
+    }
+
+    // names chosen to collide in the index: all but 0x1234 have home slot 15 and 0x1234 has home
+    // slot 0, so they form one probe run 15, 0, 1, 2, 3 that wraps around the index:
+    const uint32_t names[] = { 0x6F32, 0x6F3F, 0x1234, 0x6F54, 0x6F69 };
+    for (uint32_t name : names) {
+        // state 0 increments local 0 and moves to state 1; state 1 does nothing:
+        uint8_t sh0[] = {
+            LDL1, 0,
+            PSHA,
+            IMM1, 1,
+            ADD,
+            STL1, 0,
+            SST1, 1,
+            RET,
+        };
+        uint8_t sh1[] = {
+            RET,
+        };
+
+        if (trex_sm_create(&ctx, name, 1, 1, 2, sizeof(sh0) + sizeof(sh1)) != RESULT_OK
+         || trex_sm_define_state(&ctx, name, 0, sh0, sizeof(sh0)) != RESULT_OK
+         || trex_sm_define_state(&ctx, name, 1, sh1, sizeof(sh1)) != RESULT_OK
+        ) {
+            std::cout << "  create failed" << std::endl;
+            return 1;
+        }
+    }
+    // redefining a state reuses its bytecode range when the new code fits:
+    {
+        uint8_t sh0[] = {
+            LDL1, 0,
+            PSHA,
+            IMM1, 1,
+            ADD,
+            STL1, 0,
+            SST1, 1,
+            RET,
+        };
+        for (int n = 0; n < 4; n++) {
+            if (trex_sm_define_state(&ctx, names[0], 0, sh0, sizeof(sh0)) != RESULT_OK) {
+                std::cout << "  redefine failed" << std::endl;
+                return 1;
+            }
+        }
+    }
+    if (trex_sm_create(&ctx, 0x1234, 1, 1, 1, 1) != RESULT_NAME_EXISTS) {
+        std::cout << "  expected RESULT_NAME_EXISTS" << std::endl;
+        return 1;
+    }
+
+    // stopped machines must not run:
+    trex_exec(&ctx);
+    if (trex_sm_find(&ctx, 0x6F32)->locals[0] != 0) {
+        std::cout << "  stopped machine ran" << std::endl;
+        return 1;
+    }
+
+    for (uint32_t name : names) {
+        if (trex_sm_run(&ctx, name) != RESULT_OK) {
+            std::cout << "  run failed" << std::endl;
+            return 1;
+        }
+    }
+
+    // deleting one machine in the middle of the probe run must not disturb the others; the
+    // entries after it are shifted back:
+    if (trex_sm_delete(&ctx, names[1]) != RESULT_OK || trex_sm_find(&ctx, names[1])) {
+        std::cout << "  delete failed" << std::endl;
+        return 1;
+    }
+    if (!ctx.names[0] || ctx.machines[ctx.names[0] - 1].name != 0x1234 || ctx.names[3]) {
+        std::cout << "  probe run not shifted back" << std::endl;
+        return 1;
+    }
+    trex_exec(&ctx);
+    for (uint32_t name : names) {
+        struct trex_sm *sm = trex_sm_find(&ctx, name);
+        if (name == names[1]) {
+            continue;
+        }
+        if (!sm || sm->name != name || sm->locals[0] != 1) {
+            std::cout << "  lookup of " << std::hex << name << " failed" << std::endl;
+            return 1;
+        }
+    }
+
+    if (trex_sm_stop(&ctx, 0x1234) != RESULT_OK || trex_sm_find(&ctx, 0x1234)->exec_status != STOPPED) {
+        std::cout << "  stop failed" << std::endl;
+        return 1;
+    }
+    if (trex_sm_stop(&ctx, names[1]) != RESULT_NAME_NOT_FOUND) {
+        std::cout << "  expected RESULT_NAME_NOT_FOUND" << std::endl;
+        return 1;
+    }
+
+    std::cout << "  ok" << std::endl;
+    return 0;
+}
+
+#ifdef TREX_STATS
+int test_stats() {
+    std::cout << "stats:" << std::endl;
+
+    struct trex_context ctx;
+    struct trex_sm machines[1];
+    struct trex_sh sh[1];
+    uint32_t stack[16] = {0};
 
+    // 4 cycles per exec so the 6-instruction handler is preempted once:
+    trex_context_init(
+        &ctx,
+        nullptr,
+        stack,
+        16,
+        4,
+        sizeof(syscalls)/sizeof(struct trex_syscall),
+        syscalls
+    );
+    ctx.chips_count = 2;
+    ctx.chips = chips;
     ctx.machines_count = 1;
     ctx.machines = machines;
+    trex_sm_init(&ctx, &machines[0], 1, 0, nullptr);
 
-    trex_sm_init(
+    uint8_t code[] = {
+        PSH1, 0,
+        SYS1, 0,
+        IMM1, 1,
+        PSHA,
+        POP,
+        RET,
+    };
+    sh[0].pc_start = code;
+    sh[0].pc_end = code + sizeof(code);
+    trex_sm_verify(&ctx, &machines[0], 1, sh);
+
+    trex_exec(&ctx);
+    trex_exec(&ctx);
+
+    struct trex_sm_stats stats;
+    trex_sm_stats_snapshot(&machines[0], &stats);
+    std::cout << std::dec
+        << "  instructions = " << stats.instructions << std::endl
+        << "  syscalls     = " << stats.syscalls << std::endl
+        << "  completions  = " << stats.completions << std::endl
+        << "  slots        = " << stats.slots << std::endl
+        << "  preemptions  = " << stats.preemptions << std::endl
+        << "  max_cycles   = " << stats.max_handler_cycles << std::endl;
+
+    if (stats.syscalls != 2 || stats.completions != 1 || stats.preemptions != 2 || stats.max_handler_cycles != 6) {
+        return 1;
+    }
+
+    return 0;
+}
+#endif
+
+#ifdef TREX_TRACE
+int test_trace() {
+    std::cout << "trace:" << std::endl;
+
+    struct trex_context ctx;
+    struct trex_sm machines[1];
+    struct trex_sh sh[2];
+    uint32_t stack[16] = {0};
+    struct trex_trace_event events[16];
+
+    trex_context_init(
         &ctx,
-        &machines[0],
-        1,
+        nullptr,
+        stack,
         16,
-        locals
+        9,
+        sizeof(syscalls)/sizeof(struct trex_syscall),
+        syscalls
     );
+    ctx.chips_count = 2;
+    ctx.chips = chips;
+    ctx.machines_count = 1;
+    ctx.machines = machines;
+    trex_sm_init(&ctx, &machines[0], 1, 0, nullptr);
+    machines[0].name = 0x6F32;
+    trex_trace_init(&ctx, events, 16);
+
+    uint8_t sh0[] = {
+        PSH1, 0,
+        SYS1, 0,
+        SST1, 1,
+        RET,
+    };
+    uint8_t sh1[] = {
+        HALT,
+    };
+    sh[0].pc_start = sh0;
+    sh[0].pc_end = sh0 + sizeof(sh0);
+    sh[1].pc_start = sh1;
+    sh[1].pc_end = sh1 + sizeof(sh1);
+    trex_sm_verify(&ctx, &machines[0], 2, sh);
+
+    trex_exec(&ctx);
+
+    const uint8_t expected[] = {
+        TRACE_MACHINE,
+        TRACE_STATE,
+        TRACE_SYSCALL_ENTER,
+        TRACE_SYSCALL_EXIT,
+        TRACE_MACHINE,
+        TRACE_STATE,
+    };
+    if (ctx.trace_head != sizeof(expected)) {
+        std::cout << "  trace_head = " << ctx.trace_head << std::endl;
+        return 1;
+    }
+    for (unsigned n = 0; n < sizeof(expected); n++) {
+        if (events[n].kind != expected[n]) {
+            std::cout << "  event " << n << " kind = " << (unsigned)events[n].kind << std::endl;
+            return 1;
+        }
+    }
+    if (events[5].data != 1 || events[3].time != 2) {
+        std::cout << "  bad event data" << std::endl;
+        return 1;
+    }
+
+    std::ostringstream json;
+    trex_trace_write_chrome_json(json, events, 16, ctx.trace_head);
+    std::cout << json.str();
+
+    return 0;
+}
+#endif
+
+int test_pool() {
+    std::cout << "pool:" << std::endl;
+
+    // each context increments local 0 once per handler:
+    static uint8_t code[] = {
+        LDL1, 0,
+        PSHA,
+        IMM1, 1,
+        ADD,
+        STL1, 0,
+        RET,
+    };
+
+    struct console {
+        struct trex_context ctx;
+        struct trex_sm      sm;
+        struct trex_sh      sh[1];
+        uint32_t            locals[1];
+        uint32_t            stack[4];
+    };
+    static console consoles[37];
+
+    std::vector<struct trex_context *> ctxs;
+    for (auto &c : consoles) {
+        trex_context_init(&c.ctx, &c, c.stack, 4, 64, 0, nullptr);
+        c.ctx.machines_count = 1;
+        c.ctx.machines = &c.sm;
+        c.locals[0] = 0;
+        trex_sm_init(&c.ctx, &c.sm, 1, 1, c.locals);
+        c.sh[0].pc_start = code;
+        c.sh[0].pc_end = code + sizeof(code);
+        c.sh[0].verify_status = UNVERIFIED;
+        trex_sm_verify(&c.ctx, &c.sm, 1, c.sh);
+        ctxs.push_back(&c.ctx);
+    }
+
+    {
+        trex_pool pool(3);
+        for (int f = 0; f < 10; f++) {
+            pool.exec_frame(ctxs);
+        }
+    }
+
+    // every context must have run exactly 10 frames' worth of handlers:
+    for (auto &c : consoles) {
+        if (c.locals[0] != consoles[0].locals[0] || c.ctx.clock != 640) {
+            std::cout << "  context ran " << c.ctx.clock << " cycles" << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << "  ok" << std::endl;
+    return 0;
+}
+
+int test_queue() {
+    std::cout << "queue:" << std::endl;
+
+    static uint8_t mem[2048];
+    struct trex_arena arena;
+    trex_arena_init(&arena, mem, sizeof(mem));
+
+    // message-send-local0: posts local 0 of the current machine as a message:
+    static const struct trex_syscall host_syscalls[] = {
+        {
+            .name = "message-send-local0",
+            .args = 0,
+            .returns = 0,
+            .cost = 0,
+            .effects = SYSC_MESSAGE,
+            .call = [](struct trex_context *ctx){
+                auto *host = (trex_host<> *)ctx->hostdata;
+                host->post_message(ctx->sm->name, &ctx->sm->locals[0], sizeof(uint32_t));
+            },
+        },
+    };
+
+    struct trex_context ctx;
+    trex_host<> host(&ctx);
+    auto *stack = (uint32_t *)trex_arena_alloc_fixed(&arena, 16 * sizeof(uint32_t));
+    trex_context_init(&ctx, &host, stack, 16, 64, 1, host_syscalls);
+    ctx.arena = &arena;
+    if (trex_machines_alloc(&ctx, 4) != RESULT_OK) {
+        return 1;
+    }
+
+    static const uint8_t code[] = {
+        IMM1, 0x2A,
+        STL1, 0,
+        SYS1, 0,
+        HALT,
+    };
+
+    // four producer threads each create, define and run one machine in a single burst:
+    std::vector<std::thread> producers;
+    for (uint32_t p = 0; p < 4; p++) {
+        producers.emplace_back([&host, p] {
+            uint32_t name = 0x6F30 + p;
+            trex_command cmds[3] = {};
+            cmds[0].kind = COMMAND_CREATE;
+            cmds[0].iterations = 1;
+            cmds[0].locals_count = 1;
+            cmds[0].handlers_count = 1;
+            cmds[0].code_size = sizeof(code);
+            cmds[1].kind = COMMAND_DEFINE_STATE;
+            cmds[1].state = 0;
+            cmds[1].code = code;
+            cmds[1].code_size = sizeof(code);
+            cmds[2].kind = COMMAND_RUN;
+            for (uint32_t i = 0; i < 3; i++) {
+                cmds[i].seq = p * 3 + i;
+                cmds[i].name = name;
+                while (!host.submit(cmds[i])) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (auto &t : producers) {
+        t.join();
+    }
+
+    // the exec thread applies commands at a safe point, then executes:
+    if (host.drain() != 12) {
+        std::cout << "  drain failed" << std::endl;
+        return 1;
+    }
+    trex_exec(&ctx);
+
+    trex_reply reply;
+    unsigned ok = 0;
+    while (host.receive_reply(reply)) {
+        ok += reply.result == RESULT_OK;
+    }
+    trex_message msg;
+    unsigned messages = 0;
+    while (host.receive_message(msg)) {
+        uint32_t v;
+        memcpy(&v, msg.data, sizeof(v));
+        messages += (v == 0x2A && (msg.name & ~3u) == 0x6F30);
+    }
+    std::cout << "  replies ok = " << ok << ", messages = " << messages << std::endl;
+    if (ok != 12 || messages != 4) {
+        return 1;
+    }
+
+    return 0;
+}
+
+int test_frame_sync() {
+    std::cout << "frame sync:" << std::endl;
+
+    struct trex_context ctx;
+    struct trex_sm machines[1];
+    struct trex_sh sh[1];
+    uint32_t stack[4] = {0};
+    uint32_t locals[1] = {0};
+
+    trex_context_init(&ctx, nullptr, stack, 4, 0, 0, nullptr);
+    ctx.machines_count = 1;
+    ctx.machines = machines;
+    trex_sm_init(&ctx, &machines[0], 1, 1, locals);
+
+    // store the host time into local 0:
+    uint8_t code[] = {
+        SYS1, 0,
+        RET,
+    };
+    static const struct trex_syscall sync_syscalls[] = {
+        {
+            .name = "time-now",
+            .args = 0,
+            .returns = 0,
+            .cost = 0,
+            .effects = SYSC_READS_TIME,
+            .call = [](struct trex_context *ctx){ ctx->sm->locals[0] = ctx->now; },
+        },
+    };
+    ctx.syscalls = sync_syscalls;
+    ctx.syscalls_count = 1;
+    sh[0].pc_start = code;
+    sh[0].pc_end = code + sizeof(code);
+    trex_sm_verify(&ctx, &machines[0], 1, sh);
+
+    // NTSC: 262 scanlines, vblank starts at 225; run 3 frames:
+    trex_frame_sync sync(&ctx, 262);
+    sync.at_vblank(225, 2);
+    for (int f = 0; f < 3; f++) {
+        for (uint16_t line = 0; line < 262; line++) {
+            sync.scanline(line);
+        }
+    }
+    std::cout << "  vblank: now = " << std::dec << locals[0] << ", clock = " << ctx.clock << std::endl;
+    if (locals[0] != 2 * 262 + 226 || ctx.clock != 3 * 2) {
+        return 1;
+    }
 
-    test_branch_verify(ctx);
+    // 1 trex cycle per 6 CPU cycles, 1364 CPU cycles per scanline (227 each, carrying 2):
+    sync.per_cpu_cycles(1, 6);
+    for (uint16_t line = 0; line < 262; line++) {
+        sync.cpu_cycles(1364);
+        sync.scanline(line);
+    }
+    std::cout << "  cpu cycles: clock = " << ctx.clock << std::endl;
+    if (ctx.clock != 3 * 2 + (262 * 1364) / 6) {
+        return 1;
+    }
 
-    test_readme_program(ctx);
+    // a frame of 0 scanlines is taken as 1:
+    trex_frame_sync empty(&ctx, 0);
+    uint32_t clock = ctx.clock;
+    empty.at_vblank(225, 2);
+    empty.scanline(0);
+    if (ctx.clock != clock + 2) {
+        return 1;
+    }
 
     return 0;
 }
+
+int test_snapshot() {
+    std::cout << "snapshot:" << std::endl;
+
+    struct trex_context ctx;
+    struct trex_sm machines[2];
+    struct trex_sh sh[2][1];
+    uint32_t stack[8] = {0};
+    uint32_t locals[2][2] = {{0}};
+
+    // 5 cycles per exec so snapshots land in the middle of handlers:
+    trex_context_init(&ctx, nullptr, stack, 8, 5, 0, nullptr);
+    ctx.machines_count = 2;
+    ctx.machines = machines;
+
+    // local 1 = local 1 * 3 + local 0; local 0 += 1:
+    uint8_t code[] = {
+        LDL1, 1,
+        PSHA,
+        IMM1, 3,
+        MUL,
+        PSHA,
+        LDL1, 0,
+        ADD,
+        STL1, 1,
+        LDL1, 0,
+        PSHA,
+        IMM1, 1,
+        ADD,
+        STL1, 0,
+        RET,
+    };
+    for (int m = 0; m < 2; m++) {
+        trex_sm_init(&ctx, &machines[m], 1 + m, 2, locals[m]);
+        sh[m][0].pc_start = code;
+        sh[m][0].pc_end = code + sizeof(code);
+        trex_sm_verify(&ctx, &machines[m], 1, sh[m]);
+    }
+
+    for (int i = 0; i < 7; i++) {
+        trex_exec(&ctx);
+    }
+
+    uint32_t size = trex_snapshot_size(&ctx);
+    std::vector<uint8_t> saved(size), later(size), after(size), delta(size * 2);
+    if (trex_snapshot_save(&ctx, saved.data(), size) != RESULT_OK) {
+        return 1;
+    }
+
+    for (int i = 0; i < 13; i++) {
+        trex_exec(&ctx);
+    }
+    trex_snapshot_save(&ctx, later.data(), size);
+
+    // rewind and replay; execution must be identical:
+    if (trex_snapshot_restore(&ctx, saved.data(), size) != RESULT_OK) {
+        return 1;
+    }
+    for (int i = 0; i < 13; i++) {
+        trex_exec(&ctx);
+    }
+    trex_snapshot_save(&ctx, after.data(), size);
+    if (later != after) {
+        std::cout << "  replay diverged" << std::endl;
+        return 1;
+    }
+
+    // a delta against the earlier snapshot reconstructs the later one:
+    uint32_t delta_size = 0;
+    if (trex_snapshot_delta(saved.data(), later.data(), size, delta.data(), delta.size(), &delta_size) != RESULT_OK) {
+        std::cout << "  delta failed" << std::endl;
+        return 1;
+    }
+    std::cout << "  size = " << std::dec << size << ", delta = " << delta_size << std::endl;
+    if (delta_size == 0 || delta_size >= size
+     || trex_snapshot_apply_delta(saved.data(), size, delta.data(), delta_size) != RESULT_OK
+     || saved != later
+    ) {
+        std::cout << "  delta failed" << std::endl;
+        return 1;
+    }
+
+    // identical snapshots give an empty delta, which is not the same as a delta that does not fit:
+    if (trex_snapshot_delta(saved.data(), later.data(), size, delta.data(), 0, &delta_size) != RESULT_OK
+     || delta_size != 0
+     || trex_snapshot_apply_delta(saved.data(), size, delta.data(), 0) != RESULT_OK
+     || saved != later
+    ) {
+        std::cout << "  empty delta failed" << std::endl;
+        return 1;
+    }
+    after = later;
+    after[size - 1] ^= 1;
+    if (trex_snapshot_delta(saved.data(), after.data(), size, delta.data(), 4, &delta_size) != RESULT_OUT_OF_MEMORY) {
+        std::cout << "  expected RESULT_OUT_OF_MEMORY" << std::endl;
+        return 1;
+    }
+
+    // a corrupt snapshot is rejected without touching the context:
+    trex_snapshot_save(&ctx, later.data(), size);
+    std::vector<uint8_t> corrupt = saved;
+    uint32_t st_offset = size - (2 + 2 + 4 * 2);    // st of the last machine
+    corrupt[st_offset] = 7;
+    if (trex_snapshot_restore(&ctx, corrupt.data(), size) != RESULT_INVALID_SNAPSHOT) {
+        std::cout << "  expected RESULT_INVALID_SNAPSHOT" << std::endl;
+        return 1;
+    }
+    corrupt = saved;
+    corrupt[size - (1 + 1 + 1 + 4 + 1 + 1 + 4 + 2 + 2 + 4 * 2)] = 0xEE;   // exec_status of the last machine
+    if (trex_snapshot_restore(&ctx, corrupt.data(), size) != RESULT_INVALID_SNAPSHOT) {
+        std::cout << "  expected RESULT_INVALID_SNAPSHOT" << std::endl;
+        return 1;
+    }
+    trex_snapshot_save(&ctx, after.data(), size);
+    if (later != after) {
+        std::cout << "  rejected snapshot changed the context" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+int test_chips() {
+    std::cout << "chips:" << std::endl;
+
+    struct trex_context ctx;
+    struct trex_sm machines[1];
+    struct trex_sh sh[2];
+    uint32_t stack[8] = {0};
+    uint8_t src[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    uint8_t dst[8] = {0};
+    struct trex_chip test_chips[2] = {{src, sizeof(src)}, {dst, sizeof(dst)}};
+
+    trex_context_init(&ctx, nullptr, stack, 8, 64, sizeof(syscalls)/sizeof(struct trex_syscall), syscalls);
+    ctx.chips_count = 2;
+    ctx.chips = test_chips;
+    ctx.machines_count = 1;
+    ctx.machines = machines;
+    trex_sm_init(&ctx, &machines[0], 1, 0, nullptr);
+
+    // copy src[2..6) to dst[4..8), then read one byte past the end of src:
+    uint8_t sh0[] = {
+        PSH1, 0,
+        SYS1, 0,
+        PSH1, 2,
+        SYS1, 1,
+        PSH1, 1,
+        PSH1, 4,
+        PSH1, 4,
+        SYS1, 8,
+        SST1, 1,
+        RET,
+    };
+    uint8_t sh1[] = {
+        PSH1, 8,
+        SYS1, 1,
+        SYS1, 2,
+        POP,
+        RET,
+    };
+    sh[0].pc_start = sh0;
+    sh[0].pc_end = sh0 + sizeof(sh0);
+    sh[1].pc_start = sh1;
+    sh[1].pc_end = sh1 + sizeof(sh1);
+    trex_sm_verify(&ctx, &machines[0], 2, sh);
+
+    trex_exec(&ctx);
+    std::cout << "  exec_status = " << std::dec << machines[0].exec_status << std::endl;
+
+    const uint8_t expected[8] = {0, 0, 0, 0, 3, 4, 5, 6};
+    if (memcmp(dst, expected, sizeof(dst)) != 0) {
+        std::cout << "  copy failed" << std::endl;
+        return 1;
+    }
+    if (machines[0].exec_status != ERROR_SYSC_INVALID_ARG) {
+        return 1;
+    }
+
+    return 0;
+}
+
+int test_std_syscalls() {
+    std::cout << "std syscalls:" << std::endl;
+
+    static const struct trex_syscall std_syscalls[] = {
+        TREX_STD_SYSCALLS,
+    };
+    enum { MESSAGE_APPEND_BYTE = 11, MESSAGE_APPEND_DWORD = 13, MESSAGE_SEND = 14, TIME_NOW = 16 };
+
+    struct trex_context ctx;
+    struct trex_sm machines[1];
+    struct trex_sh sh[1] = {};
+    uint32_t stack[4] = {0};
+    uint32_t locals[1] = {0};
+    trex_host<> host(&ctx);
+
+    trex_context_init(&ctx, &host, stack, 4, 64, sizeof(std_syscalls)/sizeof(struct trex_syscall), std_syscalls);
+    ctx.message_send = trex_host<>::message_send;
+    ctx.machines_count = 1;
+    ctx.machines = machines;
+    trex_sm_init(&ctx, &machines[0], 1, 1, locals);
+    machines[0].name = 0x6F36;
+
+    // send a message tagged with a header byte only if time-now is not zero:
+    uint8_t code[] = {
+        SYS1, TIME_NOW,
+        POP,
+        BZ, 4,
+        PSH1, 0xAB,
+        SYS1, MESSAGE_APPEND_BYTE,
+        PSH4, 0x44, 0x33, 0x22, 0x11,
+        SYS1, MESSAGE_APPEND_DWORD,
+        SYS1, MESSAGE_SEND,
+        POP,
+        STL1, 0,
+        HALT,
+    };
+    sh[0].pc_start = code;
+    sh[0].pc_end = code + sizeof(code);
+    trex_sm_verify(&ctx, &machines[0], 1, sh);
+
+    std::cout << std::dec
+        << "  max_cost = " << sh[0].max_cost
+        << ", effects = " << (unsigned)sh[0].effects << std::endl;
+    if (sh[0].max_cost != 20 || sh[0].effects != (SYSC_READS_TIME | SYSC_MESSAGE | SYSC_MAY_BLOCK)) {
+        return 1;
+    }
+
+    trex_exec(&ctx);
+
+    trex_message msg;
+    if (!host.receive_message(msg) || msg.name != 0x6F36 || msg.size != 5
+     || msg.data[0] != 0xAB || msg.data[1] != 0x44 || msg.data[4] != 0x11
+     || locals[0] != 1 || ctx.message_size != 0
+    ) {
+        std::cout << "  message failed" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+int test_chip_diff() {
+    std::cout << "chip diff:" << std::endl;
+
+    static const struct trex_syscall std_syscalls[] = {
+        TREX_STD_SYSCALLS,
+    };
+    enum { CHIP_USE = 0, CHIP_ADDRESS_SET = 1, CHIP_DIFF = 9 };
+
+    struct trex_context ctx;
+    struct trex_sm machines[1];
+    struct trex_sh sh[1] = {};
+    uint32_t stack[4] = {0};
+    // local 0 = ranges found, locals 1..16 = last copy of the chip:
+    uint32_t locals[17] = {0};
+    uint8_t wram[64] = {0};
+    struct trex_chip diff_chips[1] = {{wram, sizeof(wram)}};
+
+    trex_context_init(&ctx, nullptr, stack, 4, 64, sizeof(std_syscalls)/sizeof(struct trex_syscall), std_syscalls);
+    ctx.chips_count = 1;
+    ctx.chips = diff_chips;
+    ctx.machines_count = 1;
+    ctx.machines = machines;
+    trex_sm_init(&ctx, &machines[0], 1, 17, locals);
+
+    uint8_t code[] = {
+        PSH1, 0,
+        SYS1, CHIP_USE,
+        PSH1, 0,
+        SYS1, CHIP_ADDRESS_SET,
+        PSH1, 1,
+        PSH1, sizeof(wram),
+        SYS1, CHIP_DIFF,
+        POP,
+        STL1, 0,
+        RET,
+    };
+    sh[0].pc_start = code;
+    sh[0].pc_end = code + sizeof(code);
+    trex_sm_verify(&ctx, &machines[0], 1, sh);
+    // exactly one run of the handler per exec:
+    ctx.cycles_per_exec = sh[0].max_cost;
+
+    // 3 and 5 are close enough to share a range:
+    wram[3] = 1;
+    wram[5] = 2;
+    wram[40] = 3;
+    memset(wram + 60, 4, 4);
+    trex_exec(&ctx);
+
+    const uint8_t expected[] = {
+        3, 0, 3, 0,
+        40, 0, 1, 0,
+        60, 0, 4, 0,
+    };
+    std::cout << "  ranges = " << std::dec << locals[0] << std::endl;
+    if (locals[0] != 3 || ctx.message_size != sizeof(expected) || memcmp(ctx.message, expected, sizeof(expected)) != 0) {
+        return 1;
+    }
+    if (memcmp(&locals[1], wram, sizeof(wram)) != 0) {
+        std::cout << "  copy not updated" << std::endl;
+        return 1;
+    }
+
+    // nothing changed since:
+    ctx.message_size = 0;
+    trex_exec(&ctx);
+    if (locals[0] != 0 || ctx.message_size != 0) {
+        return 1;
+    }
+
+    return 0;
+}
+
+int test_wide_ops() {
+    std::cout << "wide ops:" << std::endl;
+
+    struct trex_context ctx;
+    struct trex_sm machines[1];
+    struct trex_sh sh[1] = {};
+    uint32_t stack[4] = {0};
+    uint32_t locals[8] = {0};
+
+    trex_context_init(&ctx, nullptr, stack, 4, 1024, 0, nullptr);
+    ctx.machines_count = 1;
+    ctx.machines = machines;
+    trex_sm_init(&ctx, &machines[0], 1, 8, locals);
+
+    uint8_t code[] = {
+        // 100 / 7:
+        IMM1, 100, PSHA, IMM1, 7, DIVU, STL1, 0,
+        // -100 % 7:
+        IMM4, 0x9C, 0xFF, 0xFF, 0xFF, PSHA, IMM1, 7, MODS, STL1, 1,
+        // rotate 0x80000001 left by 1:
+        IMM4, 0x01, 0x00, 0x00, 0x80, PSHA, IMM1, 1, ROL, STL1, 2,
+        // bits 8..15 of 0x12345678:
+        IMM4, 0x78, 0x56, 0x34, 0x12, BEXT, 8, 8, STL1, 3,
+        // insert 0xAB into bits 4..11 of 0x12345678:
+        IMM4, 0x78, 0x56, 0x34, 0x12, PSHA, IMM1, 0xAB, BINS, 4, 8, STL1, 4,
+        IMM4, 0x78, 0x56, 0x34, 0x12, BSWAP, STL1, 5,
+        // lanes do not carry into each other:
+        IMM4, 0xFF, 0xFF, 0x01, 0x00, PSHA, IMM4, 0x01, 0x00, 0x01, 0x00, ADD16, STL1, 6,
+        IMM2, 0x34, 0x12, PSHA, IMM2, 0xCD, 0xAB, PACK16, STL1, 7,
+        // stops the machine before the store:
+        IMM1, 1, PSHA, IMM1, 0, DIVU, STL1, 0,
+        RET,
+    };
+    sh[0].pc_start = code;
+    sh[0].pc_end = code + sizeof(code);
+    trex_sm_verify(&ctx, &machines[0], 1, sh);
+    if (!verify_sh(ctx, machines[0], sh[0])) {
+        return 1;
+    }
+
+    trex_exec(&ctx);
+
+    const uint32_t expected[8] = {
+        14, (uint32_t)-2, 3, 0x56, 0x12345AB8, 0x78563412, 0x00020000, 0x1234ABCD,
+    };
+    std::cout << "  exec_status = " << std::dec << machines[0].exec_status << std::endl;
+    for (int l = 0; l < 8; l++) {
+        if (locals[l] != expected[l]) {
+            std::cout << "  local " << l << " = " << std::hex << locals[l] << std::endl;
+            return 1;
+        }
+    }
+    if (machines[0].exec_status != ERROR_DIVIDE_BY_ZERO) {
+        return 1;
+    }
+
+    // bitfields must fit in 32 bits:
+    uint8_t bad[] = {
+        BEXT, 30, 4,
+        RET,
+    };
+    sh[0].verify_status = UNVERIFIED;
+    sh[0].pc_start = bad;
+    sh[0].pc_end = bad + sizeof(bad);
+    trex_sm_verify(&ctx, &machines[0], 1, sh);
+    if (sh[0].verify_status != INVALID_BITFIELD) {
+        return 1;
+    }
+
+    // A is only known to be nonzero past the BZ, so its bits are not known and the BNZ path that
+    // underflows the stack must be followed:
+    uint8_t nonzero[] = {
+        LDL1, 0,
+        BZ, 5,
+        BEXT, 5, 1,
+        BNZ, 1,
+        RET,
+        POP, POP, POP, POP, POP, POP,
+        RET,
+    };
+    sh[0].verify_status = UNVERIFIED;
+    sh[0].pc_start = nonzero;
+    sh[0].pc_end = nonzero + sizeof(nonzero);
+    trex_sm_verify(&ctx, &machines[0], 1, sh);
+    if (sh[0].verify_status != INVALID_STACK_UNDERFLOW) {
+        std::cout << "  bits of a nonzero A taken as known" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+int test_indexed_locals() {
+    std::cout << "indexed locals:" << std::endl;
+
+    static const struct trex_syscall std_syscalls[] = {
+        TREX_STD_SYSCALLS,
+    };
+    enum { CHIP_USE = 0, CHIP_ADDRESS_SET = 1, CHIP_READ_LOCALS = 10, MESSAGE_APPEND_LOCALS = 15 };
+
+    struct trex_context ctx;
+    struct trex_sm machines[1];
+    struct trex_sh sh[1] = {};
+    uint32_t stack[4] = {0};
+    // locals 0..3 = table, 4 = index, 5 = lookup result, 6..7 = chip data:
+    uint32_t locals[8] = {10, 20, 30, 40, 2};
+    uint8_t wram[8] = {0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88};
+    struct trex_chip wram_chip[1] = {{wram, sizeof(wram)}};
+
+    trex_context_init(&ctx, nullptr, stack, 4, 1024, sizeof(std_syscalls)/sizeof(struct trex_syscall), std_syscalls);
+    ctx.chips_count = 1;
+    ctx.chips = wram_chip;
+    ctx.machines_count = 1;
+    ctx.machines = machines;
+    trex_sm_init(&ctx, &machines[0], 1, 8, locals);
+
+    uint8_t code[] = {
+        // local 5 = table[index]:
+        LDL1, 4,
+        LDLX, 0,
+        STL1, 5,
+        // table[index] = 99:
+        PSH1, 99,
+        LDL1, 4,
+        STLX, 0,
+        // read 2 dwords of wram into locals 6..7, then append them to the message:
+        PSH1, 0,
+        SYS1, CHIP_USE,
+        PSH1, 0,
+        SYS1, CHIP_ADDRESS_SET,
+        PSH1, 6,
+        PSH1, 2,
+        SYS1, CHIP_READ_LOCALS,
+        PSH1, 6,
+        PSH1, 2,
+        SYS1, MESSAGE_APPEND_LOCALS,
+        // index 7 + 2 is past the end of locals:
+        LDL1, 4,
+        LDLX, 7,
+        RET,
+    };
+    sh[0].pc_start = code;
+    sh[0].pc_end = code + sizeof(code);
+    trex_sm_verify(&ctx, &machines[0], 1, sh);
+    if (!verify_sh(ctx, machines[0], sh[0])) {
+        return 1;
+    }
+
+    trex_exec(&ctx);
+    std::cout << "  exec_status = " << std::dec << machines[0].exec_status << std::endl;
+    if (locals[5] != 30 || locals[2] != 99 || locals[6] != 0x44332211 || locals[7] != 0x88776655
+     || ctx.message_size != 8 || memcmp(ctx.message, wram, 8) != 0
+     || machines[0].exec_status != ERROR_LOCAL_OUT_OF_RANGE
+    ) {
+        return 1;
+    }
+
+    // a known index is checked by the verifier:
+    uint8_t bad[] = {
+        IMM1, 8,
+        LDLX, 0,
+        RET,
+    };
+    sh[0].verify_status = UNVERIFIED;
+    sh[0].pc_start = bad;
+    sh[0].pc_end = bad + sizeof(bad);
+    trex_sm_verify(&ctx, &machines[0], 1, sh);
+    if (sh[0].verify_status != INVALID_LOCAL) {
+        return 1;
+    }
+
+    return 0;
+}
+
+int test_registers() {
+    std::cout << "registers:" << std::endl;
+
+    struct trex_context ctx;
+    struct trex_sm machines[1];
+    struct trex_sh sh[1] = {};
+    uint32_t stack[4] = {0};
+    uint32_t locals[3] = {7, 3, 0};
+
+    trex_context_init(&ctx, nullptr, stack, 4, 1024, 0, nullptr);
+    ctx.machines_count = 1;
+    ctx.machines = machines;
+    trex_sm_init(&ctx, &machines[0], 1, 3, locals);
+
+    // local 2 = ((l0 + l1) * (l0 - l1)) ^ l0, without touching the stack:
+    uint8_t code[] = {
+        LDLR, 0, 0,
+        LDLR, 1, 1,
+        MOVR, 0x20,
+        ADDR, 0x21,
+        MOVR, 0x30,
+        SUBR, 0x31,
+        MULR, 0x23,
+        XORR, 0x20,
+        STLR, 2, 2,
+        RET,
+    };
+    sh[0].pc_start = code;
+    sh[0].pc_end = code + sizeof(code);
+    trex_sm_verify(&ctx, &machines[0], 1, sh);
+    if (!verify_sh(ctx, machines[0], sh[0])) {
+        return 1;
+    }
+
+    trex_exec(&ctx);
+    std::cout << "  local 2 = " << std::dec << locals[2] << std::endl;
+    if (locals[2] != ((7u + 3u) * (7u - 3u) ^ 7u)) {
+        return 1;
+    }
+
+    // r1 is only written on one branch path:
+    uint8_t bad[] = {
+        LDL1, 0,
+        BZ, 3,
+        IMMR, 1, 5,
+        STLR, 1, 2,
+        RET,
+    };
+    sh[0].verify_status = UNVERIFIED;
+    sh[0].pc_start = bad;
+    sh[0].pc_end = bad + sizeof(bad);
+    trex_sm_verify(&ctx, &machines[0], 1, sh);
+    if (sh[0].verify_status != INVALID_REGISTER) {
+        return 1;
+    }
+
+    return 0;
+}
+
+int test_loops() {
+    std::cout << "loops:" << std::endl;
+
+    struct trex_context ctx;
+    struct trex_sm machines[1];
+    struct trex_sh sh[1] = {};
+    uint32_t stack[4] = {0};
+    // locals 0..7 = table, 8 = entries to sum, 9 = sum:
+    uint32_t locals[10] = {1, 2, 3, 4, 5, 6, 7, 8, 5, 0};
+
+    trex_context_init(&ctx, nullptr, stack, 4, 1024, 0, nullptr);
+    ctx.machines_count = 1;
+    ctx.machines = machines;
+    trex_sm_init(&ctx, &machines[0], 1, 10, locals);
+
+    uint8_t code[] = {
+        LDL1, 8,
+        LPS, 8, 10,
+            LPI,
+            LDLX, 0,
+            PSHA,
+            LDL1, 9,
+            ADD,
+            STL1, 9,
+        LPE,
+        HALT,
+    };
+    sh[0].pc_start = code;
+    sh[0].pc_end = code + sizeof(code);
+    trex_sm_verify(&ctx, &machines[0], 1, sh);
+    if (!verify_sh(ctx, machines[0], sh[0])) {
+        return 1;
+    }
+
+    trex_exec(&ctx);
+    std::cout << "  sum = " << std::dec << locals[9] << ", max_cost = " << sh[0].max_cost << std::endl;
+    if (locals[9] != 1 + 2 + 3 + 4 + 5 || sh[0].max_cost != 2 + 7 * 8 + 1) {
+        return 1;
+    }
+
+    // the body must not change the stack depth:
+    uint8_t unbalanced[] = {
+        IMM1, 1,
+        LPS, 4, 2,
+            PSHA,
+        LPE,
+        POP,
+        RET,
+    };
+    // loops do not nest:
+    uint8_t nested[] = {
+        IMM1, 2,
+        LPS, 4, 4,
+            LPS, 4, 1,
+            LPE,
+        LPE,
+        RET,
+    };
+    for (auto bad : {std::make_pair(unbalanced, sizeof(unbalanced)), std::make_pair(nested, sizeof(nested))}) {
+        sh[0].verify_status = UNVERIFIED;
+        sh[0].pc_start = bad.first;
+        sh[0].pc_end = bad.first + bad.second;
+        trex_sm_verify(&ctx, &machines[0], 1, sh);
+        if (sh[0].verify_status != INVALID_LOOP) {
+            std::cout << "  verify_status = " << sh[0].verify_status << std::endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int test_chain() {
+    std::cout << "chain:" << std::endl;
+
+    for (uint8_t chain = 0; chain < 2; chain++) {
+        struct trex_context ctx;
+        struct trex_sm machines[2];
+        struct trex_sh sh[2][3];
+        uint32_t stack[4] = {0};
+
+        trex_context_init(&ctx, nullptr, stack, 4, 10, 0, nullptr);
+        ctx.machines_count = 2;
+        ctx.machines = machines;
+
+        // machine 0 steps through states 0 -> 1 -> 2; machine 1 keeps the scheduler busy:
+        uint8_t st0[] = { SST1, 1, RET };
+        uint8_t st1[] = { SST1, 2, RET };
+        uint8_t st2[] = { HALT };
+        uint8_t busy[] = { IMM1, 1, IMM1, 2, IMM1, 3, IMM1, 4, IMM1, 5, IMM1, 6, IMM1, 7, RET };
+        uint8_t *code[3] = { st0, st1, st2 };
+        uint32_t size[3] = { sizeof(st0), sizeof(st1), sizeof(st2) };
+        for (int s = 0; s < 3; s++) {
+            sh[0][s].pc_start = code[s];
+            sh[0][s].pc_end = code[s] + size[s];
+        }
+        sh[1][0].pc_start = busy;
+        sh[1][0].pc_end = busy + sizeof(busy);
+
+        trex_sm_init(&ctx, &machines[0], 1, 0, nullptr);
+        machines[0].chain = chain ? 0x3 : 0;
+        trex_sm_verify(&ctx, &machines[0], 3, sh[0]);
+        trex_sm_init(&ctx, &machines[1], 1, 0, nullptr);
+        trex_sm_verify(&ctx, &machines[1], 1, sh[1]);
+
+        trex_exec(&ctx);
+        std::cout << "  chain = " << (int)chain << ": st = " << machines[0].st
+            << ", exec_status = " << machines[0].exec_status << std::endl;
+
+        // chained states run to the end in one slot; unchained ones wait for machine 1:
+        if ((machines[0].exec_status == HALTED) != (chain != 0)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// a handler that requests a sleep and then halts does not sleep once restarted:
+static int test_sleep_halt() {
+    static const struct trex_syscall std_syscalls[] = {
+        TREX_STD_SYSCALLS,
+    };
+    enum { SLEEP = 18 };
+
+    static uint8_t mem[2048];
+    struct trex_arena arena;
+    trex_arena_init(&arena, mem, sizeof(mem));
+
+    struct trex_context ctx;
+    auto *stack = (uint32_t *)trex_arena_alloc_fixed(&arena, 16 * sizeof(uint32_t));
+    trex_context_init(&ctx, nullptr, stack, 16, 64, sizeof(std_syscalls)/sizeof(struct trex_syscall), std_syscalls);
+    ctx.arena = &arena;
+    if (trex_machines_alloc(&ctx, 1) != RESULT_OK) {
+        return 1;
+    }
+
+    // count each run, request a sleep, then halt:
+    uint8_t code[] = {
+        LDL1, 0,
+        PSH1, 1,
+        ADD,
+        STL1, 0,
+        PSH1, 5,
+        SYS1, SLEEP,
+        HALT,
+    };
+    if (trex_sm_create(&ctx, 0xA, 1, 1, 1, sizeof(code)) != RESULT_OK
+     || trex_sm_define_state(&ctx, 0xA, 0, code, sizeof(code)) != RESULT_OK
+    ) {
+        return 1;
+    }
+    struct trex_sm *sm = trex_sm_find(&ctx, 0xA);
+
+    for (uint32_t run = 1; run <= 2; run++) {
+        if (trex_sm_run(&ctx, 0xA) != RESULT_OK) {
+            return 1;
+        }
+        trex_exec_at(&ctx, 1, 64);
+        std::cout << "  halt: runs = " << sm->locals[0] << ", exec_status = " << sm->exec_status
+            << ", sleeping = " << (int)sm->sleeping << std::endl;
+        if (sm->locals[0] != run || sm->exec_status != HALTED || sm->sleeping || ctx.sleepers_count != 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int test_sleep() {
+    std::cout << "sleep:" << std::endl;
+
+    static const struct trex_syscall std_syscalls[] = {
+        TREX_STD_SYSCALLS,
+    };
+    enum { SLEEP = 18, SLEEP_UNTIL = 19 };
+
+    struct trex_context ctx;
+    struct trex_sm machines[1];
+    struct trex_sh sh[1] = {};
+    struct trex_sleeper sleepers[1];
+    uint32_t stack[4] = {0};
+    uint32_t locals[1] = {0};
+
+    trex_context_init(&ctx, nullptr, stack, 4, 64, sizeof(std_syscalls)/sizeof(struct trex_syscall), std_syscalls);
+    ctx.machines_count = 1;
+    ctx.machines = machines;
+    trex_sm_init(&ctx, &machines[0], 1, 1, locals);
+
+    // count each run, then sleep for 5 ticks:
+    uint8_t code[] = {
+        LDL1, 0,
+        PSH1, 1,
+        ADD,
+        STL1, 0,
+        PSH1, 5,
+        SYS1, SLEEP,
+        RET,
+    };
+    sh[0].pc_start = code;
+    sh[0].pc_end = code + sizeof(code);
+    trex_sm_verify(&ctx, &machines[0], 1, sh);
+
+    // without sleeper storage the sleep fails:
+    trex_exec_at(&ctx, 0, 64);
+    if (machines[0].exec_status != ERROR_SYSC_INVALID_STATE) {
+        std::cout << "  sleep without storage did not fail" << std::endl;
+        return 1;
+    }
+
+    trex_sleepers_init(&ctx, sleepers, 1);
+    locals[0] = 0;
+    trex_sm_init(&ctx, &machines[0], 1, 1, locals);
+    trex_sm_verify(&ctx, &machines[0], 1, sh);
+
+    // wake times are compared wrap-safe, so host time may roll over:
+    uint32_t wake_at = 0;
+    trex_exec_at(&ctx, 0xFFFFFFFEu, 64);
+    if (locals[0] != 1 || machines[0].exec_status != SLEEPING
+     || !trex_next_wake(&ctx, &wake_at) || wake_at != 3
+    ) {
+        std::cout << "  machine did not sleep" << std::endl;
+        return 1;
+    }
+
+    // skipped at no cost until its wake time:
+    uint32_t clock = ctx.clock;
+    trex_exec_at(&ctx, 2, 64);
+    if (locals[0] != 1 || ctx.clock != clock) {
+        std::cout << "  sleeping machine ran" << std::endl;
+        return 1;
+    }
+
+    trex_exec_at(&ctx, 3, 64);
+    std::cout << "  runs = " << locals[0] << ", wake_at = " << machines[0].wake_at << std::endl;
+    if (locals[0] != 2 || machines[0].exec_status != SLEEPING || machines[0].wake_at != 8) {
+        return 1;
+    }
+
+    // both sleeps depend on host time:
+    if (!(std_syscalls[SLEEP].effects & SYSC_READS_TIME) || !(std_syscalls[SLEEP_UNTIL].effects & SYSC_READS_TIME)) {
+        std::cout << "  sleep does not read time" << std::endl;
+        return 1;
+    }
+
+    // a sleep-until deadline that has already passed does not sleep:
+    code[8] = 2;
+    code[10] = SLEEP_UNTIL;
+    trex_exec_at(&ctx, 8, 64);
+    if (locals[0] < 4 || machines[0].exec_status == SLEEPING || ctx.sleepers_count != 0) {
+        std::cout << "  past deadline slept" << std::endl;
+        return 1;
+    }
+
+    return test_sleep_halt();
+}
+
+int test_schedule() {
+    std::cout << "schedule:" << std::endl;
+
+    uint32_t runs[2];
+    for (int edf = 0; edf < 2; edf++) {
+        struct trex_context ctx;
+        struct trex_sm machines[3];
+        struct trex_sh sh[3][1] = {};
+        uint32_t stack[4] = {0};
+        uint32_t locals[3][1] = {};
+
+        trex_context_init(&ctx, nullptr, stack, 4, 300, 0, nullptr);
+        ctx.machines_count = 3;
+        ctx.machines = machines;
+        if (edf) {
+            ctx.schedule = trex_schedule_edf;
+        }
+
+        // machine 0 is latency-critical and cheap; machines 1 and 2 are bulk work:
+        uint8_t count[] = { LDL1, 0, PSH1, 1, ADD, STL1, 0, RET };
+        uint8_t busy[] = { IMM1, 1, IMM1, 2, IMM1, 3, IMM1, 4, IMM1, 5, IMM1, 6, IMM1, 7, RET };
+        for (int m = 0; m < 3; m++) {
+            uint8_t *code = m ? busy : count;
+            uint32_t size = m ? sizeof(busy) : sizeof(count);
+            sh[m][0].pc_start = code;
+            sh[m][0].pc_end = code + size;
+            trex_sm_init(&ctx, &machines[m], 1, 1, locals[m]);
+            trex_sm_verify(&ctx, &machines[m], 1, sh[m]);
+        }
+        machines[0].latency = 10;
+        machines[1].latency = 100;
+        machines[2].latency = 100;
+
+        trex_exec(&ctx);
+        runs[edf] = locals[0][0];
+        std::cout << "  edf = " << edf << ": critical runs = " << runs[edf] << std::endl;
+    }
+
+    // earliest deadline first gives the critical machine more slots than round-robin:
+    if (runs[1] <= runs[0] + runs[0] / 2) {
+        return 1;
+    }
+
+    // the round-robin candidate just returned from a cheap state and starts an expensive one next;
+    // a deadline within the expensive state's slot goes first:
+    struct trex_context ctx;
+    struct trex_sm machines[2];
+    struct trex_sh sh[2][2] = {};
+    uint32_t stack[4] = {0};
+    uint32_t locals[1] = {0};
+
+    trex_context_init(&ctx, nullptr, stack, 4, 300, 0, nullptr);
+    ctx.machines_count = 2;
+    ctx.machines = machines;
+
+    uint8_t cheap[] = { SST1, 1, RET };
+    uint8_t busy[] = { IMM1, 1, IMM1, 2, IMM1, 3, IMM1, 4, IMM1, 5, IMM1, 6, IMM1, 7, RET };
+    uint8_t count[] = { LDL1, 0, PSH1, 1, ADD, STL1, 0, RET };
+    sh[0][0].pc_start = cheap;
+    sh[0][0].pc_end = cheap + sizeof(cheap);
+    sh[0][1].pc_start = busy;
+    sh[0][1].pc_end = busy + sizeof(busy);
+    sh[1][0].pc_start = count;
+    sh[1][0].pc_end = count + sizeof(count);
+    trex_sm_init(&ctx, &machines[0], 1, 0, nullptr);
+    trex_sm_verify(&ctx, &machines[0], 2, sh[0]);
+    trex_sm_init(&ctx, &machines[1], 1, 1, locals);
+    trex_sm_verify(&ctx, &machines[1], 1, sh[1]);
+    machines[0].nxst = 1;
+    machines[1].latency = 10;
+    machines[1].deadline = ctx.clock + sh[0][0].max_cost + 1;
+
+    struct trex_sm *next = trex_schedule_edf(&ctx);
+    std::cout << "  next state: picked machine " << next - machines << std::endl;
+    if (next != &machines[1]) {
+        return 1;
+    }
+
+    return 0;
+}
+
+// most cycles used by a slot that has ended:
+static uint32_t quota_slot_max;
+
+static struct trex_sm *schedule_quota(struct trex_context *ctx) {
+    if (ctx->slot_cycles > quota_slot_max) {
+        quota_slot_max = ctx->slot_cycles;
+    }
+    return trex_schedule_edf(ctx);
+}
+
+// a cheap state followed by an expensive one; the quota is charged for the state that runs next:
+static int test_quota_next_state() {
+    struct trex_context ctx;
+    struct trex_sm machines[1];
+    struct trex_sh sh[2] = {};
+    uint32_t stack[4] = {0};
+    uint32_t locals[1] = {0};
+
+    trex_context_init(&ctx, nullptr, stack, 4, 1024, 0, nullptr);
+    ctx.machines_count = 1;
+    ctx.machines = machines;
+    ctx.schedule = schedule_quota;
+
+    // 2 cycles, then 9 cycles which count the runs of state 1:
+    uint8_t cheap[] = { SST1, 1, RET };
+    uint8_t expensive[] = {
+        LDL1, 0,
+        PSHA,
+        IMM1, 1,
+        ADD,
+        STL1, 0,
+        PSHA,
+        POP,
+        SST1, 0,
+        RET,
+    };
+    sh[0].pc_start = cheap;
+    sh[0].pc_end = cheap + sizeof(cheap);
+    sh[1].pc_start = expensive;
+    sh[1].pc_end = expensive + sizeof(expensive);
+
+    trex_sm_init(&ctx, &machines[0], 3, 1, locals);
+    trex_sm_verify(&ctx, &machines[0], 2, sh);
+    machines[0].quota = 10;
+
+    quota_slot_max = 0;
+    trex_exec_at(&ctx, 1, 60);
+    if (ctx.slot_cycles > quota_slot_max) {
+        quota_slot_max = ctx.slot_cycles;
+    }
+    std::cout << "  next state: max_cost = " << sh[0].max_cost << ", " << sh[1].max_cost
+        << ", max slot = " << quota_slot_max << ", runs = " << locals[0] << std::endl;
+    if (sh[0].max_cost != 2 || sh[1].max_cost != 9 || quota_slot_max > 10 || locals[0] == 0) {
+        return 1;
+    }
+
+    return 0;
+}
+
+int test_quota() {
+    std::cout << "quota:" << std::endl;
+
+    static uint8_t mem[4096];
+    struct trex_arena arena;
+    trex_arena_init(&arena, mem, sizeof(mem));
+
+    struct trex_context ctx;
+    struct trex_session sessions[1] = {};
+    auto *stack = (uint32_t *)trex_arena_alloc_fixed(&arena, 16 * sizeof(uint32_t));
+    trex_context_init(&ctx, nullptr, stack, 16, 1024, 0, nullptr);
+    ctx.arena = &arena;
+    ctx.sessions_count = 1;
+    ctx.sessions = sessions;
+    if (trex_machines_alloc(&ctx, 4) != RESULT_OK) {
+        return 1;
+    }
+
+    // each handler run increments local 0:
+    uint8_t count[] = {
+        LDL1, 0,
+        PSHA,
+        IMM1, 1,
+        ADD,
+        STL1, 0,
+        RET,
+    };
+    const uint32_t names[] = { 0xA, 0xB, 0xC, 0xD };
+    for (uint32_t name : names) {
+        if (trex_sm_create(&ctx, name, 4, 1, 1, sizeof(count)) != RESULT_OK
+         || trex_sm_define_state(&ctx, name, 0, count, sizeof(count)) != RESULT_OK
+        ) {
+            std::cout << "  create failed" << std::endl;
+            return 1;
+        }
+    }
+
+    // A gets two handler runs per slot, B its full burst of four; the session fits both but not C:
+    const uint32_t c = 6; // instructions per handler run
+    sessions[0].budget = 7 * c - 1;
+    if (trex_sm_set_quota(&ctx, 0xA, 0, 2 * c) != RESULT_OK
+     || trex_sm_set_quota(&ctx, 0xB, 0, 0) != RESULT_OK
+     || trex_sm_set_quota(&ctx, 0xC, 0, 0) != RESULT_OK
+     || trex_sm_set_quota(&ctx, 0xD, TREX_NO_SESSION, c - 1) != RESULT_OK
+    ) {
+        return 1;
+    }
+
+    enum trex_result r[4];
+    for (int m = 0; m < 4; m++) {
+        r[m] = trex_sm_run(&ctx, names[m]);
+    }
+    std::cout << "  run = " << r[0] << ", " << r[1] << ", " << r[2] << ", " << r[3]
+        << ", slot cost = " << trex_sm_slot_cost(trex_sm_find(&ctx, 0xA))
+        << ", " << trex_sm_slot_cost(trex_sm_find(&ctx, 0xB)) << std::endl;
+    if (r[0] != RESULT_OK || r[1] != RESULT_OK || r[2] != RESULT_OVER_BUDGET || r[3] != RESULT_OVER_BUDGET
+     || trex_sm_find(&ctx, 0xC)->exec_status != STOPPED
+     || trex_sm_slot_cost(trex_sm_find(&ctx, 0xA)) != 2 * c
+     || trex_sm_slot_cost(trex_sm_find(&ctx, 0xB)) != 4 * c
+    ) {
+        return 1;
+    }
+
+    // each exec runs one slot of each machine, then the session's budget is used up:
+    for (int e = 0; e < 3; e++) {
+        uint32_t clock = ctx.clock;
+        trex_exec(&ctx);
+        if (ctx.clock - clock != 6 * c || sessions[0].used != 6 * c) {
+            std::cout << "  exec used " << ctx.clock - clock << " cycles" << std::endl;
+            return 1;
+        }
+    }
+    uint32_t a = trex_sm_find(&ctx, 0xA)->locals[0];
+    uint32_t b = trex_sm_find(&ctx, 0xB)->locals[0];
+    std::cout << "  runs = " << a << ", " << b << std::endl;
+    if (a != 6 || b != 12) {
+        return 1;
+    }
+
+    return test_quota_next_state();
+}
+
+int test_instances() {
+    std::cout << "instances:" << std::endl;
+
+    static uint8_t mem[4096];
+    struct trex_arena arena;
+    trex_arena_init(&arena, mem, sizeof(mem));
+
+    struct trex_context ctx;
+    auto *stack = (uint32_t *)trex_arena_alloc_fixed(&arena, 16 * sizeof(uint32_t));
+    trex_context_init(&ctx, nullptr, stack, 16, 1024, 0, nullptr);
+    ctx.arena = &arena;
+    if (trex_machines_alloc(&ctx, 8) != RESULT_OK) {
+        return 1;
+    }
+
+    // each handler run increments local 0:
+    uint8_t count[] = {
+        LDL1, 0,
+        PSHA,
+        IMM1, 1,
+        ADD,
+        STL1, 0,
+        RET,
+    };
+    enum { P = 0x1, T = 0x2, A = 0xA, B = 0xB };
+
+    // P sits below the others in the arena so that deleting it moves the template:
+    if (trex_sm_create(&ctx, P, 1, 1, 1, sizeof(count)) != RESULT_OK
+     || trex_sm_create(&ctx, T, 1, 2, 1, sizeof(count)) != RESULT_OK
+     || trex_sm_define_state(&ctx, T, 0, count, sizeof(count)) != RESULT_OK
+    ) {
+        return 1;
+    }
+    uint32_t lo = arena.lo;
+    if (trex_sm_instance(&ctx, T, A, 1) != RESULT_OK
+     || trex_sm_instance(&ctx, A, B, 1) != RESULT_OK
+     || trex_sm_instance(&ctx, T, A, 1) != RESULT_NAME_EXISTS
+    ) {
+        std::cout << "  instance failed" << std::endl;
+        return 1;
+    }
+    std::cout << "  bytes per instance = " << (arena.lo - lo) / 2 << std::endl;
+    struct trex_sm *a = trex_sm_find(&ctx, A);
+    struct trex_sm *b = trex_sm_find(&ctx, B);
+    if (arena.lo - lo != 2 * trex_sm_block_size(2, 0, 0) || a->locals_count != 2
+     || b->tmpl != trex_sm_find(&ctx, T) || trex_sm_find(&ctx, T)->refs != 3
+    ) {
+        return 1;
+    }
+
+    // shared states cannot be redefined:
+    if (trex_sm_define_state(&ctx, T, 0, count, sizeof(count)) != RESULT_RUNNING
+     || trex_sm_define_state(&ctx, A, 0, count, sizeof(count)) != RESULT_INVALID_STATE
+     || trex_sm_chain_state(&ctx, B, 0, 1) != RESULT_INVALID_STATE
+    ) {
+        std::cout << "  shared states were editable" << std::endl;
+        return 1;
+    }
+
+    if (trex_sm_run(&ctx, T) != RESULT_OK || trex_sm_run(&ctx, A) != RESULT_OK || trex_sm_run(&ctx, B) != RESULT_OK) {
+        return 1;
+    }
+    trex_exec_at(&ctx, 1, 3 * 6);
+    if (trex_sm_find(&ctx, T)->locals[0] != 1 || a->locals[0] != 1 || b->locals[0] != 1) {
+        std::cout << "  instances did not run" << std::endl;
+        return 1;
+    }
+
+    // the template's block moves down; its instances follow:
+    trex_sm_delete(&ctx, P);
+    // deleting the template keeps its handlers for the instances:
+    trex_sm_delete(&ctx, T);
+    if (a->handlers != a->tmpl->handlers || b->handlers != a->tmpl->handlers || a->tmpl->refs != 2
+     || a->handlers[0].pc_start != trex_sm_code(a->tmpl)
+    ) {
+        std::cout << "  instances lost the template's handlers" << std::endl;
+        return 1;
+    }
+    trex_exec_at(&ctx, 2, 2 * 6);
+    if (a->locals[0] != 2 || b->locals[0] != 2) {
+        std::cout << "  instances did not run after the template was deleted" << std::endl;
+        return 1;
+    }
+
+    // the last instance frees the template's block:
+    trex_sm_delete(&ctx, A);
+    trex_sm_delete(&ctx, B);
+    std::cout << "  arena used = " << arena.lo << std::endl;
+    if (arena.lo != 0) {
+        return 1;
+    }
+
+    return 0;
+}
+
+int test_constants() {
+    std::cout << "constants:" << std::endl;
+
+    static const uint32_t consts[] = { 10, 20, 30, 0x12345678 };
+
+    struct trex_context ctx;
+    struct trex_sm machines[2];
+    struct trex_sh sh[2][1] = {};
+    uint32_t stack[4] = {0};
+    uint32_t locals[2][4] = {};
+
+    trex_context_init(&ctx, nullptr, stack, 4, 64, 0, nullptr);
+    ctx.consts_count = 4;
+    ctx.consts = consts;
+    ctx.machines_count = 2;
+    ctx.machines = machines;
+
+    // both machines look up the same table; local 0 holds an index into it:
+    uint8_t code[] = {
+        LDC1, 3,
+        STL1, 1,
+        LDL1, 0,
+        LDCX, 1,
+        STL1, 2,
+        HALT,
+    };
+    for (int m = 0; m < 2; m++) {
+        sh[m][0].pc_start = code;
+        sh[m][0].pc_end = code + sizeof(code);
+        trex_sm_init(&ctx, &machines[m], 1, 4, locals[m]);
+        locals[m][0] = m;
+        trex_sm_verify(&ctx, &machines[m], 1, sh[m]);
+    }
+    trex_exec(&ctx);
+    std::cout << "  locals = " << std::hex << locals[0][1] << ", " << std::dec << locals[0][2] << ", " << locals[1][2] << std::endl;
+    if (locals[0][1] != 0x12345678 || locals[0][2] != 20 || locals[1][2] != 30) {
+        return 1;
+    }
+
+    // an index out of range at runtime stops the machine:
+    trex_sm_init(&ctx, &machines[0], 1, 4, locals[0]);
+    locals[0][0] = 3;
+    trex_sm_verify(&ctx, &machines[0], 1, sh[0]);
+    machines[1].exec_status = HALTED;
+    trex_exec(&ctx);
+    if (machines[0].exec_status != ERROR_CONSTANT_OUT_OF_RANGE) {
+        std::cout << "  exec_status = " << machines[0].exec_status << std::endl;
+        return 1;
+    }
+
+    // indices are checked at verify time, and loaded constants are known to the verifier:
+    uint8_t bad_index[] = { LDC2, 4, 0, HALT };
+    uint8_t bad_local[] = { LDC1, 0, LDLX, 0, HALT };
+    uint8_t *bad[] = { bad_index, bad_local };
+    uint32_t bad_size[] = { sizeof(bad_index), sizeof(bad_local) };
+    const verify_status expect[] = { INVALID_CONSTANT, INVALID_LOCAL };
+    for (int b = 0; b < 2; b++) {
+        struct trex_sh bsh[1] = {};
+        bsh[0].pc_start = bad[b];
+        bsh[0].pc_end = bad[b] + bad_size[b];
+        trex_sm_init(&ctx, &machines[0], 1, 4, locals[0]);
+        trex_sm_verify(&ctx, &machines[0], 1, bsh);
+        if (bsh[0].verify_status != expect[b]) {
+            std::cout << "  verify_status = " << verify_status_names[bsh[0].verify_status] << std::endl;
+            return 1;
+        }
+    }
+
+    // A is only known to be nonzero past the BZ, so the constant LDCX loads is not known and the
+    // BNZ path that underflows the stack must be followed:
+    static const uint32_t zero_consts[] = { 0, 0, 7 };
+    ctx.consts_count = 3;
+    ctx.consts = zero_consts;
+    uint8_t nonzero[] = {
+        LDL1, 0,
+        BZ, 4,
+        LDCX, 0,
+        BNZ, 1,
+        RET,
+        POP, POP, POP, POP, POP, POP,
+        RET,
+    };
+    struct trex_sh nsh[1] = {};
+    nsh[0].pc_start = nonzero;
+    nsh[0].pc_end = nonzero + sizeof(nonzero);
+    trex_sm_init(&ctx, &machines[0], 1, 4, locals[0]);
+    trex_sm_verify(&ctx, &machines[0], 1, nsh);
+    if (nsh[0].verify_status != INVALID_STACK_UNDERFLOW) {
+        std::cout << "  constant at a nonzero A taken as known" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+int test_channels() {
+    std::cout << "channels:" << std::endl;
+
+    static const struct trex_syscall std_syscalls[] = {
+        TREX_STD_SYSCALLS,
+    };
+    enum { CHANNEL_SEND = 20, CHANNEL_RECEIVE = 21, CHANNEL_WAIT = 22 };
+
+    struct trex_context ctx;
+    struct trex_sm machines[2];
+    struct trex_sh sh[2][1] = {};
+    struct trex_channel channels[1];
+    uint32_t ring[4];
+    uint32_t stack[4] = {0};
+    uint32_t locals[2][2] = {};
+
+    trex_context_init(&ctx, nullptr, stack, 4, 256, sizeof(std_syscalls)/sizeof(struct trex_syscall), std_syscalls);
+    trex_channel_init(&channels[0], ring, 4);
+    ctx.channels_count = 1;
+    ctx.channels = channels;
+    ctx.machines_count = 2;
+    ctx.machines = machines;
+
+    // machine 0 sends local 0 once, then halts:
+    uint8_t producer[] = {
+        PSH1, 0,
+        LDL1, 0,
+        PSHA,
+        SYS1, CHANNEL_SEND,
+        POP,
+        HALT,
+    };
+    // machine 1 stores each value received into local 0 and counts them in local 1, and waits
+    // whenever the channel is empty:
+    uint8_t consumer[] = {
+        PSH1, 0,
+        SYS1, CHANNEL_RECEIVE,
+        POP,
+        BZ, 12,
+        POP,
+        STL1, 0,
+        LDL1, 1,
+        PSHA,
+        IMM1, 1,
+        ADD,
+        STL1, 1,
+        RET,
+        POP,
+        PSH1, 0,
+        SYS1, CHANNEL_WAIT,
+        RET,
+    };
+    sh[0][0].pc_start = producer;
+    sh[0][0].pc_end = producer + sizeof(producer);
+    sh[1][0].pc_start = consumer;
+    sh[1][0].pc_end = consumer + sizeof(consumer);
+    trex_sm_init(&ctx, &machines[0], 1, 2, locals[0]);
+    trex_sm_init(&ctx, &machines[1], 1, 2, locals[1]);
+    trex_sm_verify(&ctx, &machines[1], 1, sh[1]);
+    if (sh[1][0].verify_status != VERIFIED) {
+        std::cout << "  verify_status = " << verify_status_names[sh[1][0].verify_status] << std::endl;
+        return 1;
+    }
+
+    // the consumer finds the channel empty and stops being scheduled:
+    trex_exec(&ctx);
+    uint32_t clock = ctx.clock;
+    trex_exec(&ctx);
+    if (machines[1].exec_status != WAITING || channels[0].waiter != 2 || ctx.clock != clock || locals[1][1] != 0) {
+        std::cout << "  consumer did not wait" << std::endl;
+        return 1;
+    }
+
+    // a send wakes it:
+    locals[0][0] = 0x55;
+    trex_sm_verify(&ctx, &machines[0], 1, sh[0]);
+    trex_exec(&ctx);
+    std::cout << "  received = " << std::hex << locals[1][0] << std::dec << ", count = " << locals[1][1] << std::endl;
+    if (locals[1][0] != 0x55 || locals[1][1] != 1 || machines[1].exec_status != WAITING) {
+        return 1;
+    }
+
+    // a full channel refuses sends:
+    for (uint32_t v = 0; v < 4; v++) {
+        ring[v] = 0;
+    }
+    channels[0].head = 0;
+    channels[0].tail = 4;
+    trex_sm_verify(&ctx, &machines[0], 1, sh[0]);
+    trex_exec(&ctx);
+    if (machines[0].exec_status != HALTED || channels[0].tail != 4) {
+        return 1;
+    }
+
+    return 0;
+}
+
+static constexpr struct trex_syscall static_syscalls[] = {
+    TREX_STD_SYSCALLS,
+};
+
+int test_static_exec() {
+    std::cout << "static exec:" << std::endl;
+
+    enum { CHIP_USE = 0, CHIP_ADDRESS_SET = 1, CHIP_READ_DWORD = 4, TIME_NOW = 16 };
+
+    // read a dword from chip 0 at the address in local 2, then the time:
+    uint8_t code[] = {
+        PSH1, 0,
+        SYS1, CHIP_USE,
+        LDL1, 2,
+        PSHA,
+        SYS1, CHIP_ADDRESS_SET,
+        SYS1, CHIP_READ_DWORD,
+        POP,
+        STL1, 0,
+        SYS1, TIME_NOW,
+        POP,
+        STL1, 1,
+        RET,
+    };
+
+    uint8_t mem[16];
+    for (int i = 0; i < 16; i++) {
+        mem[i] = (uint8_t)(i * 17);
+    }
+    struct trex_chip chip = { mem, sizeof(mem) };
+
+    uint32_t results[2][2][3];
+    uint32_t status[2][2];
+    for (int specialized = 0; specialized < 2; specialized++) {
+        struct trex_context ctx;
+        struct trex_sm machines[2];
+        struct trex_sh sh[2][1] = {};
+        uint32_t stack[4] = {0};
+        uint32_t locals[2][3] = { {0, 0, 4}, {0, 0, 14} };
+
+        if (specialized) {
+            trex_context_init_static<static_syscalls>(&ctx, nullptr, stack, 4, 64);
+        } else {
+            trex_context_init(&ctx, nullptr, stack, 4, 64, sizeof(static_syscalls)/sizeof(struct trex_syscall), static_syscalls);
+        }
+        ctx.chips_count = 1;
+        ctx.chips = &chip;
+        ctx.machines_count = 2;
+        ctx.machines = machines;
+        for (int m = 0; m < 2; m++) {
+            sh[m][0].pc_start = code;
+            sh[m][0].pc_end = code + sizeof(code);
+            trex_sm_init(&ctx, &machines[m], 1, 3, locals[m]);
+            trex_sm_verify(&ctx, &machines[m], 1, sh[m]);
+        }
+
+        // machine 1 reads past the end of the chip:
+        trex_exec_at(&ctx, 7, 64);
+        for (int m = 0; m < 2; m++) {
+            memcpy(results[specialized][m], locals[m], sizeof(locals[m]));
+            status[specialized][m] = machines[m].exec_status;
+        }
+    }
+
+    std::cout << "  local 0 = " << std::hex << results[1][0][0] << std::dec
+        << ", exec_status = " << status[1][0] << ", " << status[1][1] << std::endl;
+    if (memcmp(results[0], results[1], sizeof(results[0])) != 0 || status[0][0] != status[1][0] || status[0][1] != status[1][1]
+     || results[1][0][0] != 0x77665544 || results[1][0][1] != 7 || status[1][1] != ERROR_SYSC_INVALID_ARG
+    ) {
+        return 1;
+    }
+
+    return 0;
+}
+
+static constexpr uint32_t builder_consts[] = { 0, 0xC0DE };
+
+static constexpr struct trex_static_env builder_env = {
+    .syscalls_count = sizeof(static_syscalls) / sizeof(struct trex_syscall),
+    .syscalls = static_syscalls,
+    .consts_count = 2,
+    .consts = builder_consts,
+    .stack_size = 4,
+    .locals_count = 3,
+    .handlers_count = 2,
+};
+
+// reads the chip byte at the address in local 2; if set, stores a constant and moves to state 1.
+// counts runs in local 1:
+constexpr trex_builder<> build_poll() {
+    enum { skip };
+    trex_builder<> b;
+    b.psh(0).sys(0);                        // chip-use 0
+    b.ldl(2).op(PSHA).sys(1);               // chip-address-set
+    b.sys(2).op(POP).bz(skip);              // chip-read-no-advance-byte
+    b.ldc(1).stl(0).sst(1);
+    b.label(skip);
+    b.ldl(1).op(PSHA).imm(1).op(ADD).stl(1);
+    b.op(RET);
+    return b;
+}
+
+constexpr trex_builder<> build_idle() {
+    trex_builder<> b;
+    b.op(RET);
+    return b;
+}
+
+// invalid handlers are caught at compile time:
+static_assert(trex_static_verify(std::array<uint8_t, 2>{ POP, RET }, builder_env).verify_status == INVALID_STACK_UNDERFLOW);
+static_assert(trex_static_verify(std::array<uint8_t, 3>{ BZ, 200, RET }, builder_env).verify_status == INVALID_BRANCH_TARGET);
+static_assert(trex_static_verify(std::array<uint8_t, 3>{ LDL1, 3, RET }, builder_env).verify_status == INVALID_LOCAL);
+static_assert(trex_static_verify(std::array<uint8_t, 3>{ SYS1, 200, RET }, builder_env).verify_status == INVALID_SYSCALL_NUMBER);
+static_assert(trex_static_verify(std::array<uint8_t, 17>{ LDL1, 0, BZ, 5, BEXT, 5, 1, BNZ, 1, RET, POP, POP, POP, POP, POP, POP, RET }, builder_env).verify_status == INVALID_STACK_UNDERFLOW);
+
+int test_builder() {
+    std::cout << "builder:" << std::endl;
+
+    using poll = trex_static_handler<build_poll, builder_env>;
+    using idle = trex_static_handler<build_idle, builder_env>;
+
+    // same bytecode as written by hand:
+    const uint8_t expected[] = {
+        PSH1, 0,
+        SYS1, 0,
+        LDL1, 2,
+        PSHA,
+        SYS1, 1,
+        SYS1, 2,
+        POP,
+        BZ, 6,
+        LDC1, 1,
+        STL1, 0,
+        SST1, 1,
+        LDL1, 1,
+        PSHA,
+        IMM1, 1,
+        ADD,
+        STL1, 1,
+        RET,
+    };
+    if (poll::code.size() != sizeof(expected) || memcmp(poll::code.data(), expected, sizeof(expected)) != 0) {
+        std::cout << "  assembled bytecode differs" << std::endl;
+        return 1;
+    }
+
+    uint8_t mem[8] = {0};
+    struct trex_chip chip = { mem, sizeof(mem) };
+
+    struct trex_context ctx;
+    struct trex_sm machines[2];
+    uint32_t stack[4] = {0};
+    uint32_t locals[2][3] = { {0, 0, 4}, {0, 0, 4} };
+    trex_context_init(&ctx, nullptr, stack, 4, 64, builder_env.syscalls_count, static_syscalls);
+    ctx.consts_count = 2;
+    ctx.consts = builder_consts;
+    ctx.chips_count = 1;
+    ctx.chips = &chip;
+    ctx.machines_count = 1;
+    ctx.machines = machines;
+
+    // the compile-time results match the runtime verifier's:
+    struct trex_sh runtime[2] = { poll::sh(), idle::sh() };
+    runtime[0].verify_status = UNVERIFIED;
+    runtime[1].verify_status = UNVERIFIED;
+    trex_sm_init(&ctx, &machines[1], 1, 3, locals[1]);
+    trex_sm_verify(&ctx, &machines[1], 2, runtime);
+    std::cout << "  max_cost = " << poll::result.max_cost << ", runtime " << runtime[0].max_cost << std::endl;
+    if (runtime[0].verify_status != VERIFIED || runtime[0].max_cost != poll::result.max_cost || runtime[0].effects != poll::result.effects) {
+        return 1;
+    }
+
+    // pre-verified handlers are accepted without walking their branch paths again:
+    struct trex_sh handlers[2] = { poll::sh(), idle::sh() };
+    trex_sm_init(&ctx, &machines[0], 1, 3, locals[0]);
+    trex_sm_preverified(&builder_env, &ctx, &machines[0], 2, handlers);
+    if (machines[0].exec_status != READY || handlers[0].branch_paths != 0) {
+        std::cout << "  pre-verified handlers were not accepted" << std::endl;
+        return 1;
+    }
+
+    trex_exec(&ctx);
+    if (locals[0][1] == 0 || locals[0][0] != 0 || machines[0].st != 0) {
+        return 1;
+    }
+    mem[4] = 1;
+    trex_exec(&ctx);
+    if (locals[0][0] != 0xC0DE || machines[0].st != 1) {
+        return 1;
+    }
+
+    // a machine set up differently from the environment is verified again at runtime:
+    struct trex_sh small_handlers[2] = { poll::sh(), idle::sh() };
+    trex_sm_init(&ctx, &machines[1], 1, 2, locals[1]);
+    trex_sm_preverified(&builder_env, &ctx, &machines[1], 2, small_handlers);
+    if (machines[1].exec_status != NOT_EXECUTABLE || small_handlers[0].verify_status != INVALID_LOCAL) {
+        std::cout << "  mismatched machine was not verified again" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+int main() {
+    struct trex_context ctx;
+    struct trex_sm machines[1];
+
+    uint32_t stack[16]  = {0};
+    uint32_t locals[16] = {0};
+
+    trex_context_init(
+        &ctx,
+        nullptr,
+        stack,
+        16,
+        1024,
+        sizeof(syscalls)/sizeof(struct trex_syscall),
+        syscalls
+    );
+
+    ctx.chips_count = 2;
+    ctx.chips = chips;
+    ctx.machines_count = 1;
+    ctx.machines = machines;
+
+    trex_sm_init(
+        &ctx,
+        &machines[0],
+        1,
+        16,
+        locals
+    );
+
+    int failed = 0;
+
+    failed |= test_branch_verify(ctx);
+
+    failed |= test_readme_program(ctx);
+
+    failed |= test_arena();
+
+    failed |= test_machines();
+
+#ifdef TREX_STATS
+    failed |= test_stats();
+#endif
+
+#ifdef TREX_TRACE
+    failed |= test_trace();
+#endif
+
+    failed |= test_pool();
+
+    failed |= test_queue();
+
+    failed |= test_frame_sync();
+
+    failed |= test_snapshot();
+
+    failed |= test_chips();
+
+    failed |= test_std_syscalls();
+
+    failed |= test_chip_diff();
+
+    failed |= test_wide_ops();
+
+    failed |= test_indexed_locals();
+
+    failed |= test_registers();
+
+    failed |= test_loops();
+
+    failed |= test_chain();
+
+    failed |= test_sleep();
+
+    failed |= test_schedule();
+
+    failed |= test_quota();
+
+    failed |= test_instances();
+
+    failed |= test_constants();
+
+    failed |= test_channels();
+
+    failed |= test_static_exec();
+
+    failed |= test_builder();
+
+    return failed;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+// host-side decoder for trace rings recorded with TREX_TRACE.
+
+#include <cstdint>
+#include <ostream>
+
+extern "C" {
+#include "trex.h"
+}
+
+#ifdef TREX_TRACE
+
+// write the events of a trace ring as Chrome trace event JSON for chrome://tracing or Perfetto.
+// each state machine is a thread; scheduler slots and syscalls are slices, state transitions and
+// errors are instant events. timestamps are in instructions executed (ctx->clock) and are reported
+// to the viewer as microseconds.
+inline void trex_trace_write_chrome_json(
+    std::ostream &os,
+    const struct trex_trace_event *events,
+    uint32_t events_count,
+    uint32_t head
+) {
+    // the ring holds at most the last events_count events:
+    uint32_t first = (head > events_count) ? head - events_count : 0;
+
+    const char *sep = "";
+    auto begin = [&](const char *ph, const trex_trace_event &e) {
+        os << sep << "{\"ph\":\"" << ph << "\",\"pid\":0,\"tid\":" << e.machine << ",\"ts\":" << e.time;
+        sep = ",\n";
+    };
+
+    os << "{\"traceEvents\":[\n";
+
+    bool     slot_open = false;
+    uint16_t slot_machine = 0;
+    uint32_t last_time = 0;
+    for (uint32_t n = first; n != head; n++) {
+        const trex_trace_event &e = events[n & (events_count - 1)];
+        last_time = e.time;
+
+        switch (e.kind) {
+            case TRACE_MACHINE:
+                if (slot_open) {
+                    trex_trace_event end = e;
+                    end.machine = slot_machine;
+                    begin("E", end);
+                    os << "}";
+                }
+                begin("B", e);
+                os << ",\"name\":\"slot\",\"args\":{\"name\":" << e.data << "}}";
+                slot_open = true;
+                slot_machine = e.machine;
+                break;
+            case TRACE_STATE:
+                begin("i", e);
+                os << ",\"s\":\"t\",\"name\":\"st " << (e.data >> 16) << " -> " << (e.data & 0xFFFF) << "\"}";
+                break;
+            case TRACE_SYSCALL_ENTER:
+                begin("B", e);
+                os << ",\"name\":\"sys " << e.data << "\",\"args\":{\"args\":" << (unsigned)e.arg << "}}";
+                break;
+            case TRACE_SYSCALL_EXIT:
+                begin("E", e);
+                os << ",\"args\":{\"returns\":" << (unsigned)e.arg << "}}";
+                break;
+            case TRACE_ERROR:
+                begin("i", e);
+                os << ",\"s\":\"t\",\"name\":\"error " << e.data << "\"}";
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (slot_open) {
+        trex_trace_event end{};
+        end.time = last_time;
+        end.machine = slot_machine;
+        begin("E", end);
+        os << "}";
+    }
+
+    os << "\n]}\n";
+}
+
+#endif